@@ -23,21 +23,110 @@
 #include "utils.h"
 #include "Const.h"
 
-/* The length of a line in the card database (serial+comma+enabled+newline) */
-#define RECORD_LEN     (SERIAL_LEN+1+1+1)
+/* The length of a line in the card database (serial+comma+enabled+newline). The text database holds
+ * short serial numbers, and the wide database long serial numbers (see CardKey.h). */
+#define RECORD_LEN       (SHORT_SERIAL_LEN+1+1+1)
+#define WIDE_RECORD_LEN  (SERIAL_LEN+1+1+1)
 
 /* The name of the card database */
 #define DB_FILE        "cards.txt"
 
+/* The name of the card database when stored in binary */
+#define BIN_DB_FILE    "cards.bin"
+
+/* The name of the card database when stored as text with long serial numbers */
+#define WIDE_DB_FILE   "wcards.txt"
+
+/* The length of a record in the binary database. Each record is a packed 32-bit word (stored 
+ * LSB first) holding the card key and enabled flag, or all ones for a blank record. */
+#define BIN_RECORD_LEN 4
+#define BIN_KEY_MASK   0x00FFFFFFUL
+#define BIN_ENABLED    0x01000000UL
+#define BIN_BLANK      0xFFFFFFFFUL
+
+/* The facility code and card number held in a binary record */
+#define BIN_KEY(word)  CARD_KEY(SHORT_FORMAT, ((word) >> 16) & 0xFF, (word) & 0xFFFF)
+
 /* The character to use when blanking out card records */
 #define BLANK_CHAR     'Z'
 
+/* The name of the sorted card index, kept alongside the database */
+#define INDEX_FILE     "cards.idx"
+
+/* The name of the list of free (blank) slots, kept alongside the database */
+#define FREE_FILE      "cards.fre"
+
+/* Stored in place of the database size while a sidecar file is being modified */
+#define SIDECAR_DIRTY  0xFFFFFFFFUL
+
+/* Identifies the layout of the sidecar files. Files from before slots were widened to 32 bits 
+ * don't have it, and files from before card keys were widened to 64 bits or held the card format 
+ * have an older one, so they are rebuilt. */
+#define SIDECAR_MAGIC  0x34435348UL
+
+/* The stages of a background rebuild of the card index: creating an empty index, collecting the
+ * key of every card in the database, then heap sorting the entries (see CardDatabase::poll) */
+#define REBUILD_NONE     0
+#define REBUILD_START    1
+#define REBUILD_COLLECT  2
+#define REBUILD_HEAPIFY  3
+#define REBUILD_SORT     4
+
+/* The size of the buffer used when scanning through the database. This is a whole number of text and
+ * binary records, and the scanner reads as many whole wide records as fit, so a record never 
+ * straddles two reads. The SD library already caches the 512 byte sector being read, so this only 
+ * needs to be big enough to make the per-read overhead small. The buffer is on the stack while a
+ * scan runs rather than taking SRAM for good. */
+#define SCAN_BUFFER_LEN (10*RECORD_LEN)
+
+/*********/
+/* Types */
+/*********/
+
+/* The header at the start of the files kept alongside the database (the index and free list). 
+ * These are only trusted when the size and checksum match the database they were built from. */
+struct SidecarHeader
+{
+  unsigned long magic;
+  unsigned long dbSize;
+  unsigned long dbChecksum;
+  /* The number of entries following the header */
+  unsigned long count;
+};
+
+/* An entry in the index, mapping a card key to the slot it occupies in the database. Entries
+ * are kept sorted by key so they can be binary searched. */
+struct IndexEntry
+{
+  cardkey_t key;
+  slot_t slot;
+};
+
+/* Walks through the records of a database file in place, reading the file a block at a time */
+class RecordScanner
+{
+  private:
+    File *file;
+    int len;
+    int pos;
+    int fill;
+    char buf[SCAN_BUFFER_LEN];
+
+  public:
+    RecordScanner(File *file, int len);
+
+    /* Returns the next record, reading another block of the file if needed. 'n' is set to
+     * the length of the record, which is short for a partial record at the end of the file
+     * and zero past the end. */
+    const char *next(int &n);
+};
+
 /***********/
 /* Globals */
 /***********/
 
 /* A buffer for storing record data temporarily */
-char recordBuf[RECORD_LEN+1];
+char recordBuf[WIDE_RECORD_LEN+1];
 
 CardInfo cardInfo;
 
@@ -45,41 +134,387 @@ CardInfo cardInfo;
 /* Functions */
 /*************/
 
+static const char *file_name(int fmt)
+{
+  switch(fmt) {
+    case DATABASE_FORMAT_BINARY:
+      return BIN_DB_FILE;
+    case DATABASE_FORMAT_WIDE:
+      return WIDE_DB_FILE;
+  }
+  return DB_FILE;
+}
+
+static int record_len(int fmt)
+{
+  switch(fmt) {
+    case DATABASE_FORMAT_BINARY:
+      return BIN_RECORD_LEN;
+    case DATABASE_FORMAT_WIDE:
+      return WIDE_RECORD_LEN;
+  }
+  return RECORD_LEN;
+}
+
+/* Returns the length of the serial number at the start of a text record */
+static int serial_len(int fmt)
+{
+  return (fmt == DATABASE_FORMAT_WIDE) ? SERIAL_LEN : SHORT_SERIAL_LEN;
+}
+
+static unsigned long unpack_word(const char *buf)
+{
+  const byte *raw = (const byte*)buf;
+  return (unsigned long)raw[0] | ((unsigned long)raw[1] << 8) | 
+    ((unsigned long)raw[2] << 16) | ((unsigned long)raw[3] << 24);
+}
+
+/* Extracts the card key from a raw database record. Returns false for blank and invalid records. */
+static boolean record_to_key(int fmt, const char *buf, cardkey_t &key)
+{
+  if (fmt == DATABASE_FORMAT_BINARY) {
+    unsigned long word = unpack_word(buf);
+    if (word & ~(BIN_KEY_MASK|BIN_ENABLED)) return false;
+    key = BIN_KEY(word);
+    return true;
+  }
+  return parse_serial(buf, key) == serial_len(fmt);
+}
+
+/* Returns whether a raw record is a blank (deleted) record that can be reused */
+static boolean record_is_blank(int fmt, const char *buf)
+{
+  if (fmt == DATABASE_FORMAT_BINARY) {
+    return unpack_word(buf) == BIN_BLANK;
+  }
+  for (int n = serial_len(fmt); n > 0; n--) {
+    if (buf[n-1] != BLANK_CHAR) return false;
+  }
+  return true;
+}
+
+/* Returns whether the 'n' bytes read for a record make up a complete, newline terminated (for text) 
+ * record. Anything else is either the end of the database or a bad record. */
+static boolean is_whole_record(int fmt, const char *buf, int n)
+{
+  int len = record_len(fmt);
+  return (n == len && (fmt == DATABASE_FORMAT_BINARY || buf[len-1] == '\n'));
+}
+
+/* Returns the checksum contribution of 'len' bytes stored at offset 'off' in the database. Each
+ * byte is weighted by its position, so records can be swapped out of the checksum individually. */
+static unsigned long checksum_bytes(unsigned long off, const char *buf, int len)
+{
+  unsigned long sum = 0;
+  for (int n = 0; n < len; n++) {
+    sum += (unsigned long)(byte)buf[n] * (off+n+1);
+  }
+  return sum;
+}
+
+static boolean read_header(File &sidecar, SidecarHeader &hdr)
+{
+  if (!sidecar.seek(0)) return false;
+  return sidecar.read(&hdr, sizeof(hdr)) == sizeof(hdr) && hdr.magic == SIDECAR_MAGIC;
+}
+
+static boolean write_header(File &sidecar, SidecarHeader &hdr)
+{
+  if (!sidecar.seek(0)) return false;
+  return sidecar.write((const uint8_t*)&hdr, sizeof(hdr)) == sizeof(hdr);
+}
+
+/* Marks a sidecar file as dirty while the database and sidecar disagree. If we lose power part way 
+ * through, the sidecar is rebuilt on the next bootup. Returns false if the sidecar can't be used. */
+static boolean mark_dirty(File &sidecar, SidecarHeader &hdr)
+{
+  if (!read_header(sidecar, hdr)) {
+    return false;
+  }
+  unsigned long dbSize = hdr.dbSize;
+  hdr.dbSize = SIDECAR_DIRTY;
+  boolean ok = write_header(sidecar, hdr);
+  hdr.dbSize = dbSize;
+  return ok;
+}
+
+/* Stamps a sidecar file with the updated database size and checksum change */
+static boolean stamp_sidecar(File &sidecar, SidecarHeader &hdr, unsigned long dbSize, unsigned long delta)
+{
+  hdr.dbChecksum += delta;
+  hdr.dbSize = dbSize;
+  if (!write_header(sidecar, hdr)) {
+    return false;
+  }
+  sidecar.flush();
+  return true;
+}
+
+/* Creates a new, empty sidecar file marked as dirty until it is stamped */
+static File create_sidecar(const char *name, SidecarHeader &hdr)
+{
+  SD.remove(name);
+  File sidecar = SD.open(name, FILE_WRITE);
+  hdr.magic = SIDECAR_MAGIC;
+  hdr.dbSize = SIDECAR_DIRTY;
+  hdr.dbChecksum = 0;
+  hdr.count = 0;
+  if (sidecar && !write_header(sidecar, hdr)) {
+    sidecar.close();
+  }
+  return sidecar;
+}
+
+/* Checks a sidecar file's stamp against the database size and checksum */
+static boolean check_sidecar(const char *name, unsigned long dbSize, unsigned long dbChecksum)
+{
+  SidecarHeader hdr;
+  boolean valid = false;
+  File sidecar = SD.open(name, FILE_READ);
+  if (sidecar) {
+    valid = (read_header(sidecar, hdr) && hdr.dbSize == dbSize && hdr.dbChecksum == dbChecksum);
+    sidecar.close();
+  }
+  return valid;
+}
+
+static boolean read_entry(File &index, unsigned long pos, IndexEntry &entry)
+{
+  if (!index.seek(sizeof(SidecarHeader) + pos*sizeof(IndexEntry))) return false;
+  return index.read(&entry, sizeof(entry)) == sizeof(entry);
+}
+
+static boolean write_entry(File &index, unsigned long pos, IndexEntry &entry)
+{
+  if (!index.seek(sizeof(SidecarHeader) + pos*sizeof(IndexEntry))) return false;
+  return index.write((const uint8_t*)&entry, sizeof(entry)) == sizeof(entry);
+}
+
+/* Reads a slot number from the free list, where 'pos' counts from the bottom of the stack */
+static boolean read_slot(File &list, unsigned long pos, slot_t &slot)
+{
+  if (!list.seek(sizeof(SidecarHeader) + pos*sizeof(slot))) return false;
+  return list.read(&slot, sizeof(slot)) == sizeof(slot);
+}
+
+static boolean write_slot(File &list, unsigned long pos, slot_t slot)
+{
+  if (!list.seek(sizeof(SidecarHeader) + pos*sizeof(slot))) return false;
+  return list.write((const uint8_t*)&slot, sizeof(slot)) == sizeof(slot);
+}
+
+/* Returns the position of the first index entry with a key not less than 'key' */
+static unsigned long find_entry(File &index, unsigned long count, cardkey_t key)
+{
+  IndexEntry entry;
+  unsigned long lo = 0, hi = count;
+  while (lo < hi)
+  {
+    unsigned long mid = lo + (hi-lo)/2;
+    if (!read_entry(index, mid, entry)) break;
+    if (entry.key < key) lo = mid+1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+/* Moves 'count' index entries from position 'from' to 'to' (eg to open up or close a gap), a block
+ * at a time. Returns false if the index couldn't be read or written. */
+static boolean move_entries(File &index, unsigned long from, unsigned long to, unsigned long count)
+{
+  char buf[SCAN_BUFFER_LEN];
+  const unsigned long block = SCAN_BUFFER_LEN / sizeof(IndexEntry);
+  while (count > 0)
+  {
+    unsigned long n = (count < block) ? count : block;
+    unsigned long src = from, dst = to;
+    if (to > from) {
+      /* Moving up, so start from the end to avoid overwriting entries before they are moved */
+      src += count-n;
+      dst += count-n;
+    } else {
+      from += n;
+      to += n;
+    }
+    int len = n*sizeof(IndexEntry);
+    if (!index.seek(sizeof(SidecarHeader) + src*sizeof(IndexEntry)) || index.read(buf, len) != len) {
+      return false;
+    }
+    if (!index.seek(sizeof(SidecarHeader) + dst*sizeof(IndexEntry)) || 
+        index.write((const uint8_t*)buf, len) != (size_t)len) {
+      return false;
+    }
+    count -= n;
+  }
+  return true;
+}
+
+/* Moves an entry down the heap rooted at 'root' until the heap property holds again. Returns false
+ * if the index couldn't be read or written. */
+static boolean sift_down(File &index, unsigned long root, unsigned long count)
+{
+  IndexEntry parent, child, other;
+  if (!read_entry(index, root, parent)) return false;
+  while (2*root+1 < count)
+  {
+    unsigned long pos = 2*root+1;
+    if (!read_entry(index, pos, child)) return false;
+    if (pos+1 < count) {
+      if (!read_entry(index, pos+1, other)) return false;
+      if (other.key > child.key) {
+        pos++;
+        child = other;
+      }
+    }
+    if (child.key <= parent.key) break;
+    if (!write_entry(index, root, child)) return false;
+    root = pos;
+  }
+  return write_entry(index, root, parent);
+}
+
+/*****************/
+/* RecordScanner */
+/*****************/
+
+RecordScanner::RecordScanner(File *f, int recordLen)
+{
+  file = f;
+  len = recordLen;
+  pos = 0;
+  fill = 0;
+}
+
+const char *RecordScanner::next(int &n)
+{
+  if (pos >= fill) {
+    /* Refill the buffer with as many whole records as fit */
+    fill = file->read(buf, SCAN_BUFFER_LEN - SCAN_BUFFER_LEN%len);
+    if (fill < 0) fill = 0;
+    pos = 0;
+  }
+  n = fill-pos;
+  if (n > len) n = len;
+  const char *rec = buf + pos;
+  pos += n;
+  return rec;
+}
+
+/****************/
+/* CardDatabase */
+/****************/
+
 CardDatabase::CardDatabase()
 {
+  indexValid = false;
+  freeValid = false;
+  rebuildState = REBUILD_NONE;
+  rebuildPos = 0;
+  format = DATABASE_FORMAT_TEXT;
+  cacheCount = 0;
+  cacheHits = 0;
+  cacheMisses = 0;
+}
+
+void CardDatabase::setFormat(int fmt)
+{
+  close();
+  format = fmt;
+  indexValid = false;
+  freeValid = false;
+  rebuildState = REBUILD_NONE;
+  cacheCount = 0;
+}
+
+int CardDatabase::openDatabase(boolean create)
+{
+  if (dbFile) {
+    return DATABASE_SUCCESS;
+  }
+  if (!create && !SD.exists(file_name(format))) {
+    return DATABASE_DOES_NOT_EXIST;
+  }
+  /* Open for writing as well, so the same handle can be used for lookups and updates */
+  dbFile = SD.open(file_name(format), FILE_WRITE);
+  if (!dbFile) {
+    return DATABASE_OPEN_FAILURE;
+  }
+  return DATABASE_SUCCESS;
+}
+
+int CardDatabase::openIndex()
+{
+  if (!indexFile) {
+    indexFile = SD.open(INDEX_FILE, FILE_WRITE);
+    if (!indexFile) {
+      return DATABASE_OPEN_FAILURE;
+    }
+  }
+  return DATABASE_SUCCESS;
 }
 
-int CardDatabase::readCard(File *file, CardInfo &info)
+void CardDatabase::close()
+{
+  if (dbFile) {
+    dbFile.close();
+  }
+  if (indexFile) {
+    indexFile.close();
+  }
+}
+
+int CardDatabase::readCard(File *file, int fmt, CardInfo &info)
 {
   /* Read in the next card entry */
-  int n = read_line(file, recordBuf, sizeof(recordBuf));
+  int n = file->read(recordBuf, record_len(fmt));
+  return decodeCard(fmt, recordBuf, n, info);
+}
 
-  if (n == 0) {
+int CardDatabase::decodeCard(int fmt, const char *rec, int n, CardInfo &info)
+{
+  if (n <= 0) {
     // Reached end of file
     return DATABASE_EOF;
   }
-  else if (recordBuf[0] == '\n') {
+
+  if (fmt == DATABASE_FORMAT_BINARY) 
+  {
+    if (n < BIN_RECORD_LEN) {
+      return DATABASE_RECORD_TOO_SHORT;
+    }
+    unsigned long word = unpack_word(rec);
+    if (word == BIN_BLANK) {
+      info.setBlank();
+      return DATABASE_SUCCESS;
+    }
+    if (word & ~(BIN_KEY_MASK|BIN_ENABLED)) {
+      return DATABASE_INVALID_RECORD;
+    }
+    format_serial(BIN_KEY(word), info.serial);
+    info.enabled = ((word & BIN_ENABLED) != 0);
+    return DATABASE_SUCCESS;
+  }
+
+  if (rec[0] == '\n') {
     // Blank line of text
     return DATABASE_EOF;
   }
 
-  if (n < RECORD_LEN) {
+  int len = record_len(fmt);
+  if (n < len || memchr(rec, '\n', len-1) != NULL) {
     // Bad database entry - record is not long enough
     // TODO - log an error
     //print_prog_str(&Serial, strRecordTooShort);
     return DATABASE_RECORD_TOO_SHORT;
   }
 
-  if (recordBuf[n-1] != '\n') {
+  if (rec[len-1] != '\n') {
     // Record is too long
     //print_prog_str(&Serial, strRecordTooLong);
     return DATABASE_RECORD_TOO_LONG;
   }
 
-  // Remove the newline from the string
-  recordBuf[n-1] = 0;
-
-  if (! parseCard(recordBuf, info) )
+  if (! parseCard(fmt, rec, info) )
   {
       // Invalid record
       //print_prog_str(&Serial, strInvalidRecord);
@@ -88,61 +523,250 @@ int CardDatabase::readCard(File *file, CardInfo &info)
   return DATABASE_SUCCESS;
 }
 
-boolean CardDatabase::parseCard(char *line, CardInfo &info)
+boolean CardDatabase::parseCard(int fmt, const char *line, CardInfo &info)
 {
-    /* Tokenize the string */
-    const char *delims = ",";
-    
-    /* Note that strtok either returns NULL, or returns a non-empty string */
-    char *otherStr = strtok(line, delims);
-    if (otherStr == NULL) {
-      /* Expected card number */
+    /* Records are fixed width, so the fields sit at fixed positions: serial,enabled */
+    int len = serial_len(fmt);
+    if (line[len] != ',') {
+      /* Expected the comma after the card number */
       return false;
     }
 
-    char *enabledStr = strtok(NULL, delims);
-    if (enabledStr == NULL) {
-      /* Expected enabled flag */
-      return false;
+    cardkey_t key;
+    if (record_is_blank(fmt, line)) {
+      info.setBlank();
+    } else if (fmt == DATABASE_FORMAT_WIDE && parse_serial(line, key) == len) {
+      // Serials are zero padded in the wide database, so tidy them up
+      format_serial(key, info.serial);
+    } else {
+      memcpy(info.serial, line, len);
+      info.serial[len] = 0;
     }
+    info.enabled = (line[len+1] == '1');
+    return true;
+}
 
-    // Trim the spaces off of the card serial number
-    //while (*otherStr == ' ') otherStr++;
+int CardDatabase::formatCard(int fmt, CardInfo &info)
+{
+  if (fmt == DATABASE_FORMAT_BINARY) 
+  {
+    unsigned long word = BIN_BLANK;
+    if (!info.isBlank()) {
+      cardkey_t key;
+      if (!parse_serial(info.serial, key)) {
+        return DATABASE_INVALID_RECORD;
+      }
+      if (!KEY_IS_SHORT(key)) {
+        // The card doesn't fit in a packed record
+        return DATABASE_CARD_TOO_WIDE;
+      }
+      word = ((unsigned long)KEY_FACILITY(key) << 16) | KEY_CARD(key);
+      if (info.enabled) word |= BIN_ENABLED;
+    }
+    for (int n = 0; n < BIN_RECORD_LEN; n++) {
+      recordBuf[n] = (char)(word >> (8*n));
+    }
+    return BIN_RECORD_LEN;
+  }
+  /* Verify the serial number is okay */
+  int len = serial_len(fmt);
+  cardkey_t key;
+  if (info.isBlank()) {
+    memset(recordBuf, BLANK_CHAR, len);
+  } else if (fmt == DATABASE_FORMAT_WIDE && parse_serial(info.serial, key)) {
+    // Every serial is stored in the long form, zero padded
+    snprintf(recordBuf, sizeof(recordBuf), "%05u-%07lu/%02u", KEY_FACILITY(key), KEY_CARD(key), (unsigned int)KEY_FORMAT(key));
+  } else if (parse_serial(info.serial, key)) {
+    // Long form serials are accepted for cards that fit the short form
+    if (!KEY_IS_SHORT(key)) {
+      return DATABASE_CARD_TOO_WIDE;
+    }
+    format_serial(key, recordBuf);
+  } else if ((int)strlen(info.serial) == len) {
+    memcpy(recordBuf, info.serial, len);
+  } else {
+    return DATABASE_INVALID_RECORD;
+  }
+  sprintf(recordBuf+len, ",%c\n", info.enabled ? '1' : '0');
+  return record_len(fmt);
+}
 
-    // Trim the end of the string as well
-//    char *ptr = otherStr + strlen(otherStr)-1;
-//    while (ptr > otherStr && *ptr == ' ') *ptr = 0;
+int CardDatabase::normalizeSerial(char *serial)
+{
+  cardkey_t key;
+  int len = parse_serial(serial, key);
+  if (len == 0 || serial[len] != 0) {
+    return DATABASE_INVALID_RECORD;
+  }
+  if (format != DATABASE_FORMAT_WIDE && !KEY_IS_SHORT(key)) {
+    return DATABASE_CARD_TOO_WIDE;
+  }
+  format_serial(key, serial);
+  return DATABASE_SUCCESS;
+}
 
-    strcpy(info.serial, otherStr); // TODO - strncpy
-    info.enabled = (enabledStr[0] == '1');
-    return true;
+void CardDatabase::cacheCard(cardkey_t key, slot_t slot, boolean enabled)
+{
+  /* Find the card in the cache, or make room for it by dropping the oldest */
+  int n = 0;
+  while (n < cacheCount && cache[n].key != key) n++;
+  if (n == cacheCount) {
+    if (cacheCount < CARD_CACHE_LEN) cacheCount++;
+    n = cacheCount-1;
+  }
+  // Shuffle the more recent entries down and put this one at the front
+  for (; n > 0; n--) {
+    cache[n] = cache[n-1];
+  }
+  cache[0].key = key;
+  cache[0].slot = slot;
+  cache[0].enabled = enabled;
+}
+
+void CardDatabase::uncacheCard(slot_t slot, CardInfo &info)
+{
+  cardkey_t key;
+  boolean hasKey = parse_serial(info.serial, key);
+  int n = 0;
+  while (n < cacheCount)
+  {
+    if (cache[n].slot == slot || (hasKey && cache[n].key == key)) {
+      // Close up the gap
+      cacheCount--;
+      for (int i = n; i < cacheCount; i++) {
+        cache[i] = cache[i+1];
+      }
+    } else {
+      n++;
+    }
+  }
+}
+
+int CardDatabase::lookupCard(cardkey_t key, CardInfo &info)
+{
+  /* Check the recent lookups first */
+  for (int n = 0; n < cacheCount; n++) 
+  {
+    if (cache[n].key == key) {
+      CacheEntry entry = cache[n];
+      cacheHits++;
+      cacheCard(key, entry.slot, entry.enabled);
+      if (entry.slot == CACHE_NOT_FOUND) {
+        return DATABASE_RECORD_NOT_FOUND;
+      }
+      format_serial(key, info.serial);
+      info.slot = entry.slot;
+      info.enabled = entry.enabled;
+      return DATABASE_SUCCESS;
+    }
+  }
+
+  cacheMisses++;
+  int ret = findCard(key, info);
+  if (ret == DATABASE_SUCCESS) {
+    cacheCard(key, info.slot, info.enabled);
+  } else if (ret == DATABASE_RECORD_NOT_FOUND) {
+    cacheCard(key, CACHE_NOT_FOUND, false);
+  }
+  return ret;
+}
+
+int CardDatabase::findCard(cardkey_t key, CardInfo &info)
+{
+  int ret = openDatabase(false);
+  if (ret != DATABASE_SUCCESS) {
+    return ret;
+  }
+
+  /* Use the index to jump straight to the card record if we can */
+  if (indexValid)
+  {
+    slot_t slot;
+    ret = lookupIndex(key, slot);
+    if (ret == DATABASE_RECORD_NOT_FOUND) {
+      return ret;
+    }
+    if (ret == DATABASE_SUCCESS) {
+      cardkey_t found;
+      ret = getCard(slot, cardInfo);
+      if (ret == DATABASE_SUCCESS && parse_serial(cardInfo.serial, found) && found == key) {
+        info = cardInfo;
+        return DATABASE_SUCCESS;
+      }
+    }
+    /* The index doesn't agree with the database. Stop using it (it gets rebuilt on the
+     * next bootup) and fall back to scanning the database. */
+    indexValid = false;
+  }
+
+  /* Rewind the database */
+  if (!dbFile.seek(0)) {
+    close();
+    return DATABASE_OPEN_FAILURE;
+  }
+
+  /* Compare the key held in each raw record, and only decode the one we're after */
+  int len = record_len(format);
+  RecordScanner scanner(&dbFile, len);
+  slot_t count = 0;
+  while(1)
+  {
+    cardkey_t recordKey;
+    int n;
+    const char *rec = scanner.next(n);
+    if (!is_whole_record(format, rec, n)) {
+      // Let the decoder work out the end of file, or what is wrong with the record
+      ret = decodeCard(format, rec, n, cardInfo);
+      if (ret == DATABASE_EOF || ret == DATABASE_SUCCESS) {
+        ret = DATABASE_RECORD_NOT_FOUND;
+      }
+      break;
+    }
+
+    if (record_to_key(format, rec, recordKey) && recordKey == key) 
+    {
+      /* Found the card in the database */
+      ret = decodeCard(format, rec, n, info);
+      info.slot = count;
+      break;
+    }
+    count++;
+  }
+  return ret;
 }
 
 int CardDatabase::lookupCard(char *serial, CardInfo &info)
 {
-  if (!SD.exists(DB_FILE)) {
-    return DATABASE_DOES_NOT_EXIST;
+  cardkey_t key;
+  int len = parse_serial(serial, key);
+  if (len && serial[len] == 0) {
+    return lookupCard(key, info);
   }
-  
-  /* Load the database */
-  File file = SD.open(DB_FILE, FILE_READ);
-  if (!file) {
+
+  int ret = openDatabase(false);
+  if (ret != DATABASE_SUCCESS) {
+    return ret;
+  }
+  if (!dbFile.seek(0)) {
+    close();
     return DATABASE_OPEN_FAILURE;
   }
   
   /* Database rows are fixed width, with data encoded in readable ascii. Note
    * every record must end in a newline character.
    *
-   * serial,enabled\n       (serial=9 chars, enabled=1 char, plus newline)
+   * serial,enabled\n       (serial=9 or 13 chars, enabled=1 char, plus newline)
    * ...
    */
-  int count = 0;
+  RecordScanner scanner(&dbFile, record_len(format));
+  slot_t count = 0;
 
-  int ret = DATABASE_EOF;
   while(1)
   {
     // Read the next card entry
-    ret = readCard(&file, cardInfo);
+    int n;
+    const char *rec = scanner.next(n);
+    ret = decodeCard(format, rec, n, cardInfo);
     
     // If we reach the end of file, the record wasn't found
     if (ret == DATABASE_EOF) {
@@ -161,29 +785,71 @@ int CardDatabase::lookupCard(char *serial, CardInfo &info)
       break;
     }
   }
-  file.close();
   return ret;
 }
 
-int CardDatabase::getCard(unsigned int slot, CardInfo &info)
+int CardDatabase::lookupIndex(cardkey_t key, slot_t &slot)
 {
-  File file = SD.open(DB_FILE, FILE_READ);
-  if (!file) {
-    return DATABASE_OPEN_FAILURE;
+  int ret = openIndex();
+  if (ret != DATABASE_SUCCESS) {
+    return ret;
+  }
+
+  SidecarHeader hdr;
+  IndexEntry entry;
+  ret = DATABASE_RECORD_NOT_FOUND;
+  if (!read_header(indexFile, hdr)) {
+    ret = DATABASE_INVALID_RECORD;
+  } else {
+    unsigned long pos = find_entry(indexFile, hdr.count, key);
+    if (pos < hdr.count && read_entry(indexFile, pos, entry) && entry.key == key) {
+      slot = entry.slot;
+      ret = DATABASE_SUCCESS;
+    }
+  }
+  return ret;
+}
+
+int CardDatabase::prewarm()
+{
+  int ret = openDatabase(false);
+  if (ret != DATABASE_SUCCESS || !indexValid) {
+    return ret;
+  }
+  ret = openIndex();
+  if (ret != DATABASE_SUCCESS) {
+    return ret;
+  }
+  /* Read the header and the middle entry, which is where every search of the index starts */
+  SidecarHeader hdr;
+  IndexEntry entry;
+  if (read_header(indexFile, hdr) && hdr.count > 0) {
+    read_entry(indexFile, hdr.count/2, entry);
+  }
+  return DATABASE_SUCCESS;
+}
+
+int CardDatabase::getCard(slot_t slot, CardInfo &info)
+{
+  int ret = openDatabase(false);
+  if (ret != DATABASE_SUCCESS) {
+    return ret;
   }
   
-  unsigned long size = file.size();
-  unsigned long off = slot*RECORD_LEN;
+  unsigned long size = dbFile.size();
+  unsigned long off = slot*record_len(format);
   
   /* Make sure we don't jump past the end of the file - since seek doesn't seem to check for that */
-  if (off >= size || !file.seek(off)) {
-    file.close();
+  if (off >= size) {
+    return DATABASE_EOF;
+  }
+  if (!dbFile.seek(off)) {
+    close();
     return DATABASE_EOF;
   }
   
   // Read the card record
-  int ret = readCard(&file, info);
-  file.close();
+  ret = readCard(&dbFile, format, info);
 
   if (ret == DATABASE_SUCCESS) {
     info.slot = slot;
@@ -191,70 +857,533 @@ int CardDatabase::getCard(unsigned int slot, CardInfo &info)
   return ret;
 }
 
-int CardDatabase::putCard(unsigned int slot, CardInfo &info)
+int CardDatabase::putCard(slot_t slot, CardInfo &info)
 {
-  /* Verify the serial number is okay */
-  if (strlen(info.serial) != SERIAL_LEN) {
-    return DATABASE_INVALID_RECORD;
+  /* Format the fixed-length record (verifying the serial number is okay) */
+  int len = formatCard(format, info);
+  if (len < 0) {
+    return len;
   }
 
-  /* Load the database */
-  File file = SD.open(DB_FILE, FILE_WRITE);
-  if (!file) {
-    return DATABASE_OPEN_FAILURE;
+  /* Load the database (creating it if needed) */
+  int ret = openDatabase(true);
+  if (ret != DATABASE_SUCCESS) {
+    return ret;
   }
   
-  unsigned long size = file.size();
+  unsigned long size = dbFile.size();
   unsigned long off;
  
-  if (slot == -1) {
+  if (slot == NO_SLOT) {
     /* Append the record */
     off = size;
   } else {
     /* Overwrite an existing record */
-    off = slot*RECORD_LEN;
+    off = slot*len;
   }
   
 //  Serial.println(off);
 //  Serial.println(size);
 //  Serial.println(slot);
 
-  if (off > size || !file.seek(off)) {
-    file.close();
+  if (off > size) {
+    return DATABASE_EOF;
+  }
+  if (!dbFile.seek(off)) {
+    close();
     return DATABASE_EOF;
   }
-  
-  /* Format the fixed-length record and write it out */
-  sprintf(recordBuf, "%9s,%c\n", info.serial, info.enabled ? '1' : '0');
-  file.write(recordBuf);
 
-  /* Close up the file again */
-  file.close();
+  /* Hang on to the record being overwritten, so it can be swapped out of the index and free list */
+  char oldBuf[WIDE_RECORD_LEN];
+  int oldLen = 0;
+  if ((indexValid || freeValid) && off < size) {
+    oldLen = dbFile.read(oldBuf, len);
+    if (oldLen < 0 || !dbFile.seek(off)) {
+      close();
+      return DATABASE_EOF;
+    }
+  }
+
+  /* Mark the sidecar files as dirty until they are brought up to date */
+  SidecarHeader indexHdr, freeHdr;
+  if (indexValid && (openIndex() != DATABASE_SUCCESS || !mark_dirty(indexFile, indexHdr))) {
+    indexValid = false;
+  }
+  File freeList;
+  if (freeValid) {
+    freeList = SD.open(FREE_FILE, FILE_WRITE);
+    if (!freeList || !mark_dirty(freeList, freeHdr)) {
+      freeValid = false;
+    }
+  }
+
+  if (slot == NO_SLOT) {
+    slot = off/len;
+  }
+
+  /* Forget anything cached about this slot, or about the card now stored in it */
+  uncacheCard(slot, info);
+
+  /* The database is changing under a background rebuild of the index, so start it again */
+  if (rebuildState != REBUILD_NONE) {
+    rebuildState = REBUILD_START;
+  }
+
+  /* Write out the record, and make sure it reaches the card */
+  if (dbFile.write((const uint8_t*)recordBuf, len) != (size_t)len) {
+    // Something is wrong with the SD card, so start again with fresh handles next time
+    indexValid = false;
+    freeValid = false;
+    if (freeList) {
+      freeList.close();
+    }
+    close();
+    return DATABASE_OPEN_FAILURE;
+  }
+  dbFile.flush();
+  unsigned long newSize = dbFile.size();
+
+  boolean wholeOld = (oldLen == len);
+
+  if (indexValid) 
+  {
+    /* Bring the index up to date with the new record */
+    cardkey_t oldKey, newKey;
+    boolean hadOld = (wholeOld && record_to_key(format, oldBuf, oldKey));
+    boolean hasNew = parse_serial(info.serial, newKey);
+    IndexEntry entry;
+    boolean ok = true;
+
+    if (hadOld && hasNew && oldKey == newKey) {
+      // The card keeps its place in the index
+      hadOld = hasNew = false;
+    }
+
+    if (hadOld) {
+      /* Find the entry for the old key (there may be duplicates) and close up the gap */
+      unsigned long pos = find_entry(indexFile, indexHdr.count, oldKey);
+      while (pos < indexHdr.count) 
+      {
+        ok = read_entry(indexFile, pos, entry);
+        if (!ok || entry.key != oldKey || entry.slot == slot) break;
+        pos++;
+      }
+      if (ok && pos < indexHdr.count && entry.key == oldKey) {
+        ok = move_entries(indexFile, pos+1, pos, indexHdr.count-pos-1);
+        indexHdr.count--;
+      }
+    }
+    if (hasNew && ok) {
+      /* Open up a gap in the index and insert the new entry */
+      unsigned long pos = find_entry(indexFile, indexHdr.count, newKey);
+      entry.key = newKey;
+      entry.slot = slot;
+      ok = move_entries(indexFile, pos, pos+1, indexHdr.count-pos) && write_entry(indexFile, pos, entry);
+      indexHdr.count++;
+    }
+    if (!ok) {
+      /* The index is left marked as dirty, so it isn't trusted again until it is rebuilt */
+      indexValid = false;
+    }
+  }
+
+  if (freeValid)
+  {
+    /* Bring the free list up to date */
+    boolean wasBlank = (wholeOld && record_is_blank(format, oldBuf));
+    boolean isBlank = info.isBlank();
+
+    boolean ok = true;
+
+    if (isBlank && !wasBlank) {
+      // Release the slot by pushing it onto the free list
+      ok = write_slot(freeList, freeHdr.count++, slot);
+    } else if (wasBlank && !isBlank) {
+      /* Claim the slot. It is normally the top of the list (see insertCard) but an admin might 
+       * edit any blank record, in which case the top entry is moved into its place. */
+      slot_t top, other;
+      unsigned long pos = freeHdr.count;
+      while (pos > 0) 
+      {
+        ok = read_slot(freeList, pos-1, other);
+        if (!ok || other == slot) break;
+        pos--;
+      }
+      if (ok && pos > 0) {
+        ok = read_slot(freeList, freeHdr.count-1, top) && write_slot(freeList, pos-1, top);
+        freeHdr.count--;
+      }
+    }
+    if (!ok) {
+      /* The list is left marked as dirty, so a live record is never handed out as a free slot */
+      freeValid = false;
+    }
+  }
+
+  /* Stamp the sidecar files with the updated database */
+  unsigned long delta = checksum_bytes(off, recordBuf, len) - checksum_bytes(off, oldBuf, oldLen);
+  if (indexValid && !stamp_sidecar(indexFile, indexHdr, newSize, delta)) {
+    indexValid = false;
+  }
+  if (freeValid && !stamp_sidecar(freeList, freeHdr, newSize, delta)) {
+    freeValid = false;
+  }
+  if (freeList) {
+    freeList.close();
+  }
 
   return DATABASE_SUCCESS;
 }
 
+int CardDatabase::nextFreeSlot(slot_t &slot)
+{
+  SidecarHeader hdr;
+  File list = SD.open(FREE_FILE, FILE_READ);
+  if (!list) {
+    return DATABASE_OPEN_FAILURE;
+  }
+  int ret = DATABASE_RECORD_NOT_FOUND;
+  if (!read_header(list, hdr)) {
+    ret = DATABASE_INVALID_RECORD;
+  } else if (hdr.count > 0 && read_slot(list, hdr.count-1, slot)) {
+    ret = DATABASE_SUCCESS;
+  }
+  list.close();
+  return ret;
+}
+
 int CardDatabase::insertCard(CardInfo &info)
 {
-  CardInfo tmp;
+  cardkey_t key;
+  boolean hasKey = parse_serial(info.serial, key);
+  // Append the record to the file unless we find a blank slot
+  slot_t slot = NO_SLOT;
 
-  // Make sure the serial doesn't already exist
-  strcpy(tmp.serial, info.serial);
-  int ret = lookupCard(tmp.serial, tmp);
-  if (ret == DATABASE_SUCCESS) {
-    return DATABASE_ALREADY_EXISTS;
+  if (hasKey && indexValid && freeValid)
+  {
+    /* Check for the serial in the index, and take the slot on top of the free list */
+    CardInfo tmp;
+    int ret = lookupCard(key, tmp);
+    if (ret == DATABASE_SUCCESS) {
+      return DATABASE_ALREADY_EXISTS;
+    }
+    if (ret != DATABASE_RECORD_NOT_FOUND && ret != DATABASE_DOES_NOT_EXIST) {
+      return ret;
+    }
+    ret = nextFreeSlot(slot);
+    if (ret == DATABASE_RECORD_NOT_FOUND) {
+      // No blank slots, so append the record
+      return putCard(NO_SLOT, info);
+    }
+    /* Make sure the slot really is blank before overwriting it */
+    if (ret == DATABASE_SUCCESS && getCard(slot, tmp) == DATABASE_SUCCESS && tmp.isBlank()) {
+      return putCard(slot, info);
+    }
+    // The free list doesn't agree with the database, so fall back to scanning
+    freeValid = false;
+    slot = NO_SLOT;
   }
 
-  // Now try to insert the new card into a blank slot
-  tmp.setBlank();
-  
-  ret = lookupCard(tmp.serial, tmp);
-  if (ret == DATABASE_SUCCESS) {
-    // Overwrite the blank record
-    return putCard(tmp.slot, info);
+  /* In a single pass over the database, make sure the serial doesn't already exist and find 
+   * the first blank slot to reuse. A missing database is simply created by putCard. */
+  if (openDatabase(false) == DATABASE_SUCCESS && dbFile.seek(0)) 
+  {
+    RecordScanner scanner(&dbFile, record_len(format));
+    slot_t count = 0;
+    int ret;
+    while(1)
+    {
+      int n;
+      const char *rec = scanner.next(n);
+      if (!is_whole_record(format, rec, n)) {
+        // Either the end of the database, or a bad record
+        ret = decodeCard(format, rec, n, cardInfo);
+        if (ret == DATABASE_EOF || ret == DATABASE_SUCCESS) {
+          ret = DATABASE_SUCCESS;
+        }
+        break;
+      }
+
+      if (record_is_blank(format, rec)) {
+        if (slot == NO_SLOT) slot = count;
+      } else {
+        cardkey_t recordKey;
+        boolean match;
+        if (hasKey) {
+          match = (record_to_key(format, rec, recordKey) && recordKey == key);
+        } else {
+          // Not a valid card key, so compare the serial number as a string
+          match = (decodeCard(format, rec, n, cardInfo) == DATABASE_SUCCESS && 
+                   strcmp(cardInfo.serial, info.serial) == 0);
+        }
+        if (match) {
+          ret = DATABASE_ALREADY_EXISTS;
+          break;
+        }
+      }
+      count++;
+    }
+    if (ret != DATABASE_SUCCESS) {
+      return ret;
+    }
+  }
+  return putCard(slot, info);
+}
+
+int CardDatabase::begin()
+{
+  close();
+
+  /* If the database only exists in another format, convert it over */
+  for (int other = 0; other < DATABASE_NUM_FORMATS && !SD.exists(file_name(format)); other++) 
+  {
+    if (other != format && SD.exists(file_name(other))) {
+      int ret = convertDatabase(other);
+      if (ret != DATABASE_SUCCESS) {
+        return ret;
+      }
+    }
+  }
+
+  /* Work out the stamp of the current database contents */
+  unsigned long sum = 0, off = 0;
+  if (openDatabase(false) == DATABASE_SUCCESS && dbFile.seek(0)) {
+    RecordScanner scanner(&dbFile, record_len(format));
+    while(1) {
+      int n;
+      const char *rec = scanner.next(n);
+      if (n == 0) break;
+      sum += checksum_bytes(off, rec, n);
+      off += n;
+    }
+  }
+
+  /* Rebuild the sidecar files that don't match it */
+  indexValid = check_sidecar(INDEX_FILE, off, sum);
+  freeValid = check_sidecar(FREE_FILE, off, sum);
+
+  /* The index is rebuilt a step at a time from the main loop, as heap sorting it on the SD card
+   * takes several minutes on a large database. The free list only takes one pass. */
+  rebuildState = indexValid ? REBUILD_NONE : REBUILD_START;
+
+  int ret = DATABASE_SUCCESS;
+  if (!freeValid) {
+    ret = rebuildFreeList();
+  }
+  return ret;
+}
+
+int CardDatabase::poll()
+{
+  if (rebuildState == REBUILD_NONE) {
+    return DATABASE_SUCCESS;
   }
-  // No blank spots so append the record to the file instead
-  return putCard(-1, info);
+  int ret = rebuildIndexStep();
+  if (ret != DATABASE_SUCCESS) {
+    /* Give up until the next bootup. The index is left marked as dirty, so it isn't trusted. */
+    rebuildState = REBUILD_NONE;
+    close();
+  }
+  return ret;
+}
+
+boolean CardDatabase::isRebuilding()
+{
+  return rebuildState != REBUILD_NONE;
+}
+
+int CardDatabase::rebuildIndexStep()
+{
+  SidecarHeader hdr;
+  IndexEntry entry, last;
+
+  if (rebuildState == REBUILD_START)
+  {
+    /* Start from an empty index */
+    indexValid = false;
+    if (indexFile) {
+      indexFile.close();
+    }
+    indexFile = create_sidecar(INDEX_FILE, hdr);
+    if (!indexFile) {
+      return DATABASE_OPEN_FAILURE;
+    }
+    rebuildState = REBUILD_COLLECT;
+    rebuildPos = 0;
+    return DATABASE_SUCCESS;
+  }
+
+  /* A missing database is just empty */
+  int ret = openDatabase(false);
+  if (ret != DATABASE_SUCCESS && ret != DATABASE_DOES_NOT_EXIST) {
+    return ret;
+  }
+  unsigned long size = (ret == DATABASE_SUCCESS) ? dbFile.size() : 0;
+  if (openIndex() != DATABASE_SUCCESS || !read_header(indexFile, hdr)) {
+    return DATABASE_OPEN_FAILURE;
+  }
+
+  if (rebuildState == REBUILD_COLLECT)
+  {
+    /* Collect the key of every card in the next block of the database */
+    char buf[SCAN_BUFFER_LEN];
+    int len = record_len(format);
+    int n = 0;
+    if (rebuildPos < size) {
+      if (!dbFile.seek(rebuildPos)) {
+        return DATABASE_OPEN_FAILURE;
+      }
+      n = dbFile.read(buf, (SCAN_BUFFER_LEN/len)*len);
+      if (n <= 0) {
+        return DATABASE_OPEN_FAILURE;
+      }
+    }
+    hdr.dbChecksum += checksum_bytes(rebuildPos, buf, n);
+    for (int pos = 0; pos + len <= n; pos += len)
+    {
+      if (record_to_key(format, buf+pos, entry.key)) {
+        entry.slot = (rebuildPos+pos)/len;
+        if (!write_entry(indexFile, hdr.count++, entry)) {
+          return DATABASE_OPEN_FAILURE;
+        }
+      }
+    }
+    rebuildPos += n;
+    if (rebuildPos >= size) {
+      rebuildState = REBUILD_HEAPIFY;
+      rebuildPos = hdr.count/2;
+    }
+    return write_header(indexFile, hdr) ? DATABASE_SUCCESS : DATABASE_OPEN_FAILURE;
+  }
+
+  /* Sort the entries in place with a heap sort, which only ever holds a few entries at a time.
+   * Each step moves one entry down the heap. */
+  boolean ok = true;
+  if (rebuildState == REBUILD_HEAPIFY) 
+  {
+    if (rebuildPos > 0) {
+      ok = sift_down(indexFile, --rebuildPos, hdr.count);
+    } else {
+      rebuildState = REBUILD_SORT;
+      rebuildPos = hdr.count;
+    }
+  } 
+  else if (rebuildPos > 1) 
+  {
+    // Move the largest key to the end of the unsorted entries
+    unsigned long n = --rebuildPos;
+    ok = read_entry(indexFile, 0, entry) && read_entry(indexFile, n, last) &&
+         write_entry(indexFile, n, entry) && write_entry(indexFile, 0, last) && 
+         sift_down(indexFile, 0, n);
+  } 
+  else 
+  {
+    /* Stamp the index so it is trusted from now on */
+    hdr.dbSize = size;
+    ok = write_header(indexFile, hdr);
+    indexFile.flush();
+    indexValid = ok;
+    rebuildState = REBUILD_NONE;
+  }
+  return ok ? DATABASE_SUCCESS : DATABASE_OPEN_FAILURE;
+}
+
+int CardDatabase::rebuildFreeList()
+{
+  SidecarHeader hdr;
+
+  freeValid = false;
+
+  /* Start from an empty free list */
+  File list = create_sidecar(FREE_FILE, hdr);
+  if (!list) {
+    return DATABASE_OPEN_FAILURE;
+  }
+
+  /* Push every blank slot, from the end of the database backwards so the lowest slot is on
+   * top of the list and gets reused first */
+  unsigned long off = 0;
+  int len = record_len(format);
+  boolean ok = true;
+  if (openDatabase(false) == DATABASE_SUCCESS && dbFile.seek(0)) {
+    RecordScanner scanner(&dbFile, len);
+    while(ok)
+    {
+      int n;
+      const char *rec = scanner.next(n);
+      if (n == 0) break;
+      hdr.dbChecksum += checksum_bytes(off, rec, n);
+      if (n == len && record_is_blank(format, rec)) {
+        ok = write_slot(list, hdr.count++, off/len);
+      }
+      off += n;
+    }
+  }
+
+  /* Reverse the slots so the lowest ends up on top */
+  for (unsigned long n = 0; ok && n < hdr.count/2; n++) {
+    slot_t lo, hi;
+    ok = read_slot(list, n, lo) && read_slot(list, hdr.count-1-n, hi) &&
+         write_slot(list, n, hi) && write_slot(list, hdr.count-1-n, lo);
+  }
+
+  /* Stamp the free list so it is trusted from now on, unless it couldn't be written out in full */
+  if (ok) {
+    hdr.dbSize = off;
+    ok = write_header(list, hdr);
+  }
+  list.close();
+  if (!ok) {
+    return DATABASE_OPEN_FAILURE;
+  }
+  freeValid = true;
+  return DATABASE_SUCCESS;
+}
+
+int CardDatabase::convertDatabase(int from)
+{
+  CardInfo info;
+  close();
+  File src = SD.open(file_name(from), FILE_READ);
+  if (!src) {
+    return DATABASE_OPEN_FAILURE;
+  }
+  File dst = SD.open(file_name(format), FILE_WRITE);
+  if (!dst) {
+    src.close();
+    return DATABASE_OPEN_FAILURE;
+  }
+
+  /* Copy every record across (including blanks) so the slot numbers are preserved */
+  RecordScanner scanner(&src, record_len(from));
+  int ret;
+  while(1)
+  {
+    int n;
+    const char *rec = scanner.next(n);
+    ret = decodeCard(from, rec, n, info);
+    if (ret == DATABASE_EOF) {
+      ret = DATABASE_SUCCESS;
+      break;
+    }
+    if (ret != DATABASE_SUCCESS) break;
+
+    int len = formatCard(format, info);
+    if (len < 0) {
+      ret = len;
+      break;
+    }
+    dst.write((const uint8_t*)recordBuf, len);
+  }
+  src.close();
+  dst.close();
+
+  if (ret != DATABASE_SUCCESS) {
+    /* Don't leave a partial database behind, so the conversion is tried again next time */
+    SD.remove(file_name(format));
+  }
+  return ret;
 }
 
 const prog_char *CardDatabase::getErrorStr(int code)
@@ -278,6 +1407,8 @@ const prog_char *CardDatabase::getErrorStr(int code)
       return strDatabaseDoesNotExist;
     case DATABASE_ALREADY_EXISTS:
       return strSerialExists;
+    case DATABASE_CARD_TOO_WIDE:
+      return strCardTooWide;
   };
   return strDatabaseFailure;
 }
@@ -285,27 +1416,31 @@ const prog_char *CardDatabase::getErrorStr(int code)
 int CardDatabase::enumerateRecords(CardCallback func)
 {
   CardInfo info;
-  /* Open the database */
-  File file = SD.open(DB_FILE, FILE_READ);
-  if (!file) {
+  int ret = openDatabase(false);
+  if (ret != DATABASE_SUCCESS) {
+    return ret;
+  }
+  if (!dbFile.seek(0)) {
+    close();
     return DATABASE_OPEN_FAILURE;
   }
 
-  int count=1;
+  RecordScanner scanner(&dbFile, record_len(format));
+  slot_t count=1;
   while(1)
   {
     // Read in the next card info and print it
-    int ret = readCard(&file, info);
+    int n;
+    const char *rec = scanner.next(n);
+    ret = decodeCard(format, rec, n, info);
 
     if (ret == DATABASE_EOF) break;
     if (ret != DATABASE_SUCCESS) {
-      file.close();
       return ret;
     }
     info.slot = count++;
     func(info);
   }
-  file.close();
   return DATABASE_SUCCESS;
 }
 
@@ -23,6 +23,7 @@
 
 #include "Arduino.h"
 #include <SD.h>
+#include "CardKey.h"
 
 #define DATABASE_SUCCESS             0
 #define DATABASE_OPEN_FAILURE       -1
@@ -33,19 +34,31 @@
 #define DATABASE_EOF                -6
 #define DATABASE_DOES_NOT_EXIST     -7
 #define DATABASE_ALREADY_EXISTS     -8
+#define DATABASE_CARD_TOO_WIDE      -9
 
-#define SERIAL_LEN                  (3+1+5)
+/* The on-disk formats supported for the database */
+#define DATABASE_FORMAT_TEXT         0
+#define DATABASE_FORMAT_BINARY       1
+#define DATABASE_FORMAT_WIDE         2
+#define DATABASE_NUM_FORMATS         3
 
 // Card serial number type
 typedef char serial_t[SERIAL_LEN+1];
 
+/* Card slot number type. This is 32-bit so that record offsets (slot*record length) don't 
+ * overflow on databases with more than a few thousand cards. */
+typedef unsigned long slot_t;
+
+/* A slot number that doesn't refer to any record, eg to have putCard append a new one */
+#define NO_SLOT              ((slot_t)-1)
+
 // Represents a single card in the database
 class CardInfo
 {
   public:
     serial_t serial;
     // The 'slot' the card occupies in the database (starts at 0)
-    unsigned int slot;
+    slot_t slot;
     boolean enabled;
     
     /* Set the card info to represent a blank record (ie deleted) */
@@ -57,38 +70,160 @@ class CardInfo
 
 typedef void (*CardCallback)(CardInfo&);
 
+/* The number of recent card lookups remembered by the database (13 bytes of SRAM each) */
+#define CARD_CACHE_LEN       4
+
+/* The slot held by a cache entry for a card that isn't in the database */
+#define CACHE_NOT_FOUND      NO_SLOT
+
+/* A recently looked up card, and where it was found in the database */
+struct CacheEntry
+{
+  cardkey_t key;
+  slot_t slot;
+  boolean enabled;
+};
+
 /* Interface to the card number database. Card records are stored as fixed-length ascii strings
- * for random access and ease of debugging. See 'docs/Database.txt' for more information. */
+ * for random access and ease of debugging, or optionally as packed 32-bit words to save space
+ * and parsing. Cards wider than the 26-bit format need the (longer) wide ascii records. See 
+ * 'docs/Database.txt' for more information. */
 class CardDatabase
 {
   private:
     /* The error code (zero = no error) */
     int error;
 
-    /* Reads a card record from the file stream. On success, this function returns DATABASE_SUCCESS and
-     * fills in 'info'. Otherwise it returns one of the DATABASE_* error codes */
-    int readCard(File *file, CardInfo &info);
-    boolean parseCard(char *line, CardInfo &info);
+    /* The format of the database file (one of DATABASE_FORMAT_*) */
+    int format;
+
+    /* Reads a card record in the given format from the file stream. On success, this function returns 
+     * DATABASE_SUCCESS and fills in 'info'. Otherwise it returns one of the DATABASE_* error codes */
+    int readCard(File *file, int fmt, CardInfo &info);
+
+    /* Decodes a raw record of 'n' bytes in the given format. Returns DATABASE_SUCCESS and fills in 'info',
+     * or returns DATABASE_EOF at the end of the database, or one of the other error codes. */
+    int decodeCard(int fmt, const char *rec, int n, CardInfo &info);
+    boolean parseCard(int fmt, const char *line, CardInfo &info);
+
+    /* Formats a card record in the given format into the record buffer. Returns the length of 
+     * the record, or DATABASE_INVALID_RECORD if the card can't be stored in that format. */
+    int formatCard(int fmt, CardInfo &info);
+
+    /* Copies the database stored in format 'from' into a new database file in the current format */
+    int convertDatabase(int from);
+
+    /* The database and card index files, kept open between operations */
+    File dbFile;
+    File indexFile;
+
+    /* Opens the database file if it isn't open already. Returns DATABASE_DOES_NOT_EXIST if
+     * there is no database yet, unless 'create' is set. */
+    int openDatabase(boolean create);
+    int openIndex();
+
+    /* Whether the card index matches the database and can be used for lookups */
+    boolean indexValid;
+
+    /* How far a background rebuild of the card index has got (one of REBUILD_*), and where it
+     * is up to within that stage (see 'poll') */
+    byte rebuildState;
+    unsigned long rebuildPos;
+
+    /* Does the next step of rebuilding the card index. Returns DATABASE_SUCCESS, or the error
+     * code if the index couldn't be read or written. */
+    int rebuildIndexStep();
+
+    /* Searches the card index for the given key. Returns DATABASE_SUCCESS and fills in
+     * 'slot' if the key is indexed, otherwise returns the error code. */
+    int lookupIndex(cardkey_t key, slot_t &slot);
+
+    /* Whether the free slot list matches the database and can be used for inserts */
+    boolean freeValid;
+
+    /* Returns the blank slot on top of the free list in 'slot', or DATABASE_RECORD_NOT_FOUND 
+     * if there are no blank slots. */
+    int nextFreeSlot(slot_t &slot);
+
+    /* The most recently looked up cards (both found and not found), most recent first */
+    CacheEntry cache[CARD_CACHE_LEN];
+    int cacheCount;
+
+    /* Searches the database (through the index if possible) for the given key */
+    int findCard(cardkey_t key, CardInfo &info);
+
+    /* Moves a card to the front of the cache, adding it if it isn't there */
+    void cacheCard(cardkey_t key, slot_t slot, boolean enabled);
+
+    /* Drops the cache entries for the given slot, or for the card being written to it */
+    void uncacheCard(slot_t slot, CardInfo &info);
 
   public:
+    /* The number of card lookups answered from the cache, or from the SD card */
+    unsigned long cacheHits;
+    unsigned long cacheMisses;
+
     CardDatabase();
 
     static const prog_char *getErrorStr(int code);
 
+    /* Closes the database files. They are opened again when next needed, which is also how
+     * we recover after an error reading or writing the SD card. */
+    void close();
+
+    /* Selects the on-disk format of the database. Call this before 'begin'. */
+    void setFormat(int fmt);
+
+    /* Checks a serial number typed in by hand and puts it in the form it is stored in (eg the 
+     * short form for a card that fits it). Returns DATABASE_SUCCESS, DATABASE_INVALID_RECORD if 
+     * it isn't a serial number, or DATABASE_CARD_TOO_WIDE if the card can't be stored in the
+     * current format. The buffer must hold SERIAL_LEN+1 chars. */
+    int normalizeSerial(char *serial);
+
+    /* Checks the card index and free slot list against the database, rebuilding them if they are
+     * missing or stale. If the database only exists in the other format, it is converted first. 
+     * Sorting a large index takes a long time, so it is rebuilt in the background (see 'poll') 
+     * and cards are found by scanning the database until it is ready. Call this once the SD card 
+     * has been initialized. */
+    int begin();
+
+    /* Does a little more of a background rebuild of the card index, if one is under way. Call 
+     * this from the main loop while no card is being read. Returns DATABASE_SUCCESS, or the 
+     * error code if the rebuild had to be given up (it is tried again on the next bootup). */
+    int poll();
+
+    /* Whether the card index is being rebuilt in the background */
+    boolean isRebuilding();
+
+    /* Rebuilds the list of free (blank) slots from the contents of the database */
+    int rebuildFreeList();
+
     /* Lookup a card in the database. Fills information in 'info'
      * and returns DATABASE_SUCCESS if the card is found, otherwise 
-     * leaves info unchanged and returns the error code. */
+     * leaves info unchanged and returns the error code. Recently 
+     * looked up cards are answered without reading the SD card. */
+    int lookupCard(cardkey_t key, CardInfo &info);
+
+    /* Gets ready for a lookup while a card is still being read: opens the database and index 
+     * files, and reads the start of the index search so it is waiting in the SD card's buffer. 
+     * Returns DATABASE_SUCCESS, or the error code if a file couldn't be opened. */
+    int prewarm();
+
+    /* Lookup a card by serial number. Serials that make a valid card key are looked up by key, 
+     * anything else (eg a blank record) is compared as a string. */
     int lookupCard(char *serial, CardInfo &info);
 
     /* Retreive a card given the slot number (index starts at 0) */
-    int getCard(unsigned int slot, CardInfo &info);
+    int getCard(slot_t slot, CardInfo &info);
 
-    /* Saves a card in the database (index from 0) */
-    int putCard(unsigned int slot, CardInfo &info);
+    /* Saves a card in the database (index from 0, or NO_SLOT to append it) */
+    int putCard(slot_t slot, CardInfo &info);
 
-    /* Inserts card data into the database at the first empty slot, or appended if
-     * there are no slots available. Returns the slot number occuped by the record,
-     * or the error code upon failure. */
+    /* Inserts card data into the database at an empty slot, or appended if there are 
+     * no slots available. Returns DATABASE_ALREADY_EXISTS if the serial is already in 
+     * the database, otherwise DATABASE_SUCCESS or the error code upon failure. The index 
+     * and free list are used when available, otherwise the database is scanned once to 
+     * check the serial and find the first empty slot. */
     int insertCard(CardInfo &info);
 
     /* Enumerates the records in the card database, calling 'func' for each record */
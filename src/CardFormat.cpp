@@ -0,0 +1,137 @@
+/*
+ * haus|prox - Electronic door access control system
+ * Copyright (C) 2011  Peter Rogers (peter.rogers@gmail.com)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* CardFormat.cpp */
+
+#include "CardFormat.h"
+
+/* Bits are numbered from the end of the card data, so bit 0 is the last bit received (the 
+ * trailing parity bit in most formats). */
+
+/* Returns 'n' bits (less than 32) of the payload, starting at bit 'pos' */
+static unsigned long get_bits(unsigned long low, byte high, byte pos, byte n)
+{
+  unsigned long v = low >> pos;
+  if (pos + n > 32) {
+    v |= (unsigned long)high << (32 - pos);
+  }
+  return v & ((1UL << n) - 1);
+}
+
+/* Returns 1 if an odd number of bits are set, otherwise 0 */
+static byte parity(unsigned long v)
+{
+  v ^= v >> 16;
+  v ^= v >> 8;
+  v ^= v >> 4;
+  v ^= v >> 2;
+  v ^= v >> 1;
+  return v & 1;
+}
+
+/* H10301, the 26-bit open format:
+ *
+ *   P FFFFFFFF CCCCCCCCCCCCCCCC P
+ *
+ * The first parity bit is even parity over the first 13 bits, and the last is odd parity over 
+ * the last 13 bits. */
+static boolean decode_26bit(unsigned long low, byte high, cardkey_t &key)
+{
+  if (parity(get_bits(low, high, 13, 13)) != 0 || parity(get_bits(low, high, 0, 13)) != 1) {
+    return false;
+  }
+  key = CARD_KEY(26, get_bits(low, high, 17, 8), get_bits(low, high, 1, 16));
+  return true;
+}
+
+/* H10306, 34-bit with a 16-bit facility code. Like the 26-bit format, each parity bit covers 
+ * half of the card data (17 bits). */
+static boolean decode_34bit(unsigned long low, byte high, cardkey_t &key)
+{
+  if (parity(get_bits(low, high, 17, 17)) != 0 || parity(get_bits(low, high, 0, 17)) != 1) {
+    return false;
+  }
+  key = CARD_KEY(34, get_bits(low, high, 17, 16), get_bits(low, high, 1, 16));
+  return true;
+}
+
+/* Corporate 1000, 35-bit with a 12-bit company code and 20-bit card number:
+ *
+ *   P P FFFFFFFFFFFF CCCCCCCCCCCCCCCCCCCC P
+ *
+ * The second bit is even parity over two out of every three bits following it, and the last bit 
+ * is odd parity over an offset two out of three bits. The first bit is odd parity over the lot. */
+#define C1K_EVEN_LOW    0xB6DB6DB6UL
+#define C1K_EVEN_HIGH   0x03
+#define C1K_ODD_LOW     0x6DB6DB6DUL
+#define C1K_ODD_HIGH    0x03
+#define C1K_ALL_LOW     0xFFFFFFFFUL
+#define C1K_ALL_HIGH    0x07
+
+static boolean decode_35bit(unsigned long low, byte high, cardkey_t &key)
+{
+  if (parity(low & C1K_EVEN_LOW) != parity(high & C1K_EVEN_HIGH) || 
+      parity(low & C1K_ODD_LOW) == parity(high & C1K_ODD_HIGH) ||
+      parity(low & C1K_ALL_LOW) == parity(high & C1K_ALL_HIGH)) {
+    return false;
+  }
+  key = CARD_KEY(35, get_bits(low, high, 21, 12), get_bits(low, high, 1, 20));
+  return true;
+}
+
+/* H10304, 37-bit with a 16-bit facility code and 19-bit card number. The parity bits each cover 
+ * 19 bits, overlapping in the middle. */
+static boolean decode_37bit(unsigned long low, byte high, cardkey_t &key)
+{
+  if (parity(get_bits(low, high, 18, 19)) != 0 || parity(get_bits(low, high, 0, 19)) != 1) {
+    return false;
+  }
+  key = CARD_KEY(37, get_bits(low, high, 20, 16), get_bits(low, high, 1, 19));
+  return true;
+}
+
+/* The supported formats. To support another format, write a decoder for it and add it here. The 
+ * 26-bit format is the most common, so it goes first. The table is kept in program memory. */
+PROGMEM static const CardFormat cardFormats[] = {
+  {26, decode_26bit},
+  {34, decode_34bit},
+  {35, decode_35bit},
+  {37, decode_37bit},
+};
+
+#define NUM_CARD_FORMATS  (sizeof(cardFormats)/sizeof(cardFormats[0]))
+
+boolean find_card_format(unsigned long low, byte high, CardFormat &format)
+{
+  for (byte n = 0; n < NUM_CARD_FORMATS; n++) 
+  {
+    /* The sentinel must be the only bit set ahead of the card data */
+    byte bits = pgm_read_byte(&cardFormats[n].bits);
+    boolean match;
+    if (bits < 32) {
+      match = (high == 0 && (low >> bits) == 1);
+    } else {
+      match = ((high >> (bits - 32)) == 1);
+    }
+    if (match) {
+      memcpy_P(&format, &cardFormats[n], sizeof(CardFormat));
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,50 @@
+/*
+ * haus|prox - Electronic door access control system
+ * Copyright (C) 2011  Peter Rogers (peter.rogers@gmail.com)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* CardFormat.h */
+
+#ifndef __CARD_FORMAT_H__
+#define __CARD_FORMAT_H__
+
+#include "Arduino.h"
+#include "CardKey.h"
+
+/* The reader sends the card's (Wiegand) data as a stream of payload bits, with a single 1 bit
+ * (the sentinel) just ahead of the card data and zeros before that. The position of the sentinel 
+ * gives the length of the card data, which is how the format of the card is recognized.
+ *
+ * Payloads are passed around as the last 32 bits received ('low') plus the 8 bits before them 
+ * ('high'), which covers every format up to 39 bits. */
+
+/* Decodes the card data of a particular format into a card key (which includes the format's 
+ * length). Returns false if the card's parity bits don't check out. */
+typedef boolean (*CardDecoder)(unsigned long low, byte high, cardkey_t &key);
+
+/* An entry in the table of supported card formats */
+struct CardFormat
+{
+  /* The length of the card data in bits (not including the sentinel) */
+  byte bits;
+  CardDecoder decode;
+};
+
+/* Looks up the format matching the length of the payload. Returns false if the format isn't 
+ * supported. */
+boolean find_card_format(unsigned long low, byte high, CardFormat &format);
+
+#endif
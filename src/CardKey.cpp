@@ -0,0 +1,112 @@
+/*
+ * haus|prox - Electronic door access control system
+ * Copyright (C) 2011  Peter Rogers (peter.rogers@gmail.com)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* CardKey.cpp */
+
+#include "CardKey.h"
+
+/* Reads 'n' decimal digits. Returns false if any of them isn't a digit. */
+static boolean parse_digits(const char *str, int n, unsigned long &value)
+{
+  value = 0;
+  for (int i = 0; i < n; i++)
+  {
+    char ch = str[i];
+    if (ch < '0' || ch > '9') {
+      return false;
+    }
+    value = 10*value + (ch - '0');
+  }
+  return true;
+}
+
+/* Writes 'value' as 'n' decimal digits, zero padded */
+static void format_digits(unsigned long value, char *str, int n)
+{
+  for (int i = n-1; i >= 0; i--) {
+    str[i] = '0' + value%10;
+    value /= 10;
+  }
+}
+
+cardkey_t make_card_key(byte bits, unsigned int facility, unsigned long card)
+{
+  return ((cardkey_t)bits << 48) | ((cardkey_t)(facility & 0xFFFFU) << 32) | (card & 0xFFFFFFFFUL);
+}
+
+byte key_format(cardkey_t key)
+{
+  return (byte)(key >> 48);
+}
+
+unsigned int key_facility(cardkey_t key)
+{
+  return (unsigned int)((key >> 32) & 0xFFFFU);
+}
+
+unsigned long key_card(cardkey_t key)
+{
+  return (unsigned long)(key & 0xFFFFFFFFUL);
+}
+
+int parse_serial(const char *serial, cardkey_t &key)
+{
+  unsigned long facility, card, bits = SHORT_FORMAT;
+
+  /* The facility code runs up to the dash, and its length tells us which form this is */
+  int n = 0;
+  while (n <= 5 && serial[n] >= '0' && serial[n] <= '9') n++;
+  if ((n != 3 && n != 5) || serial[n] != '-') {
+    return 0;
+  }
+  boolean isShort = (n == 3);
+  if (!parse_digits(serial, n, facility)) {
+    return 0;
+  }
+  if (isShort) {
+    if (!parse_digits(serial+4, 5, card)) {
+      return 0;
+    }
+  } else if (!parse_digits(serial+6, 7, card) || serial[13] != '/' || !parse_digits(serial+14, 2, bits)) {
+    return 0;
+  }
+
+  if (bits == SHORT_FORMAT ? (facility > 0xFF || card > 0xFFFF) : 
+      (bits == 0 || facility > MAX_FACILITY || card > MAX_CARD)) {
+    return 0;
+  }
+  key = CARD_KEY(bits, facility, card);
+  return isShort ? SHORT_SERIAL_LEN : SERIAL_LEN;
+}
+
+void format_serial(cardkey_t key, char *serial)
+{
+  if (KEY_IS_SHORT(key)) {
+    format_digits(KEY_FACILITY(key), serial, 3);
+    serial[3] = '-';
+    format_digits(KEY_CARD(key), serial+4, 5);
+    serial[SHORT_SERIAL_LEN] = 0;
+    return;
+  }
+  format_digits(KEY_FACILITY(key), serial, 5);
+  serial[5] = '-';
+  format_digits(KEY_CARD(key), serial+6, 7);
+  serial[13] = '/';
+  format_digits(KEY_FORMAT(key), serial+14, 2);
+  serial[SERIAL_LEN] = 0;
+}
@@ -0,0 +1,71 @@
+/*
+ * haus|prox - Electronic door access control system
+ * Copyright (C) 2011  Peter Rogers (peter.rogers@gmail.com)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* CardKey.h */
+
+#ifndef __CARD_KEY_H__
+#define __CARD_KEY_H__
+
+#include "Arduino.h"
+
+/* The length of a card serial number, not including the null. 26-bit cards (8-bit facility code, 
+ * 16-bit card number) use the short form FFF-CCCCC. Other cards use the long form FFFFF-CCCCCCC/BB,
+ * which ends with the length of the card data in bits. A serial_t holds either. */
+#define SHORT_SERIAL_LEN            (3+1+5)
+#define SERIAL_LEN                  (5+1+7+1+2)
+
+/* Cards are identified internally by a packed key holding the length of the card data in bits
+ * (which is the card's format, see CardFormat.h) in the top 16 bits, the facility code (up to 16 
+ * bits) below that and the card number (up to 20 bits) in the lower half. Cards of different 
+ * formats are different cards, even if their facility code and card number are the same. Serial
+ * number strings are only made when talking to people (console and logs). */
+typedef unsigned long long cardkey_t;
+
+#define CARD_KEY(bits, facility, card)  make_card_key(bits, facility, card)
+#define KEY_FORMAT(key)             key_format(key)
+#define KEY_FACILITY(key)           key_facility(key)
+#define KEY_CARD(key)               key_card(key)
+
+/* The largest format (two digits), facility code and card number that can be stored in a key */
+#define MAX_FORMAT                  99
+#define MAX_FACILITY                0xFFFFUL
+#define MAX_CARD                    0xFFFFFUL
+
+/* The format with short serial numbers */
+#define SHORT_FORMAT                26
+
+/* Whether the key is for a 26-bit card, and so has a short serial number */
+#define KEY_IS_SHORT(key)           (KEY_FORMAT(key) == SHORT_FORMAT)
+
+/* Packs a card key, and takes one apart again (see CARD_KEY and friends). These aren't inline, as
+ * the 64-bit shifts and masks take a lot of code on the AVR. */
+cardkey_t make_card_key(byte bits, unsigned int facility, unsigned long card);
+byte key_format(cardkey_t key);
+unsigned int key_facility(cardkey_t key);
+unsigned long key_card(cardkey_t key);
+
+/* Parses the serial number (FFF-CCCCC or FFFFF-CCCCCCC/BB) at the start of 'serial' into a card 
+ * key. Returns the length of the serial number, or zero if it is badly formed or the facility code
+ * and card number are too big for the format. A 26-bit card can be given in either form. */
+int parse_serial(const char *serial, cardkey_t &key);
+
+/* Formats a card key as a null-terminated serial number, in the short form for a 26-bit card. 
+ * The buffer must hold SERIAL_LEN+1 chars. */
+void format_serial(cardkey_t key, char *serial);
+
+#endif
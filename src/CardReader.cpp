@@ -37,28 +37,172 @@
  *
  *   START = 1011 = 0xB (starting block)
  *   END   = 1111 = 0xF (finishing block)
- *   LRC   = LRC checksum on entire block stream
+ *   LRC   = XOR of every block from START to END inclusive
  *
  * The stream of DATA blocks further encode a PAYLOAD stream:
  *
  *   DATA    = 0 PAYLOAD (the MSB of DATA is always zero)
  *   PAYLOAD = b2 b1 b0
  * 
- * The entire PAYLOAD sequence contains the facility code, card number and two parity bits:
+ * The PAYLOAD sequence ends with the card data, preceded by a single 1 bit (the sentinel) and
+ * zeros. For example the 26-bit format holds the facility code, card number and two parity bits:
  *
- *           | 8 bits   | 16 bits     |
- *  JUNK | P | FACILITY | CARD NUMBER | P
+ *                   | 8 bits   | 16 bits     |
+ *  000...000 | 1 | P | FACILITY | CARD NUMBER | P
  *
- * Only the final 26 bits of the sequence are considered, the rest are ignored (JUNK).
+ * The length of the card data picks the format used to decode it (see CardFormat.cpp).
  *
  */
 
 #include "Arduino.h"
 #include "CardReader.h"
+#include "CardFormat.h"
 #include "Const.h"
+#include "Pins.h"
+
+typedef FastPin<PIN_CLOCK> ClockPin;
+typedef FastPin<PIN_DATA> DataPin;
+typedef FastPin<PIN_PRESENT> PresentPin;
+typedef FastPin<PIN_BEEP> BeepPin;
+
+/* Beep patterns, as pairs of beep and gap lengths (ms) ending with a zero. Each ends with a gap, 
+ * so it doesn't run into the next pattern queued. */
+PROGMEM const unsigned int beepStartup[] = {500, 200, 0};
+PROGMEM const unsigned int beepFail[] = {200, 200, 200, 200, 200, 200, 0};
+PROGMEM const unsigned int beepTest[] = {200, 200, 400, 400, 200, 200, 0};
+
+/* The number of zeros before the start segment */
+#define LEADING_ZEROS       25
+
+/* The reader sometimes slips a bit or two at the start of a frame, so the start segment is looked 
+ * for up to this many bits either side of where it should be */
+#define SLIP_BITS           2
+
+/* Decoder states, following the layout of the card data above */
+#define DECODE_LEADING      0
+#define DECODE_START        1
+#define DECODE_DATA         2
+#define DECODE_LRC          3
+/* The frame didn't decode, but the rest of its bits are kept so the main loop can try again */
+#define DECODE_STORE        4
+#define DECODE_TRAILING     5
+#define DECODE_FINISHED     6
+
+/* Segment values */
+#define SEGMENT_BITS        5
+#define SEGMENT_START       0xB
+#define SEGMENT_END         0xF
+#define SEGMENT_PAD_BIT     0x8
+#define SEGMENT_PAYLOAD     0x7
+
+/* Each 5-bit segment is looked up in a table, giving the block (d3 d2 d1 d0) in the low nibble 
+ * and these flags in the high nibble */
+#define SEGMENT_BLOCK_MASK  0x0F
+#define SEGMENT_VALID       0x10
+#define SEGMENT_IS_START    0x20
+#define SEGMENT_IS_END      0x40
+
+/* Builds the table entry for a segment. Segments without odd parity aren't valid. */
+#define SEGMENT_ODD(s)      ((((s) >> 0) ^ ((s) >> 1) ^ ((s) >> 2) ^ ((s) >> 3) ^ ((s) >> 4)) & 1)
+#define SEGMENT_ENTRY(s)    (SEGMENT_ODD(s) ? (((s) & SEGMENT_BLOCK_MASK) | SEGMENT_VALID | \
+                              (((s) & SEGMENT_BLOCK_MASK) == SEGMENT_START ? SEGMENT_IS_START : 0) | \
+                              (((s) & SEGMENT_BLOCK_MASK) == SEGMENT_END ? SEGMENT_IS_END : 0)) : 0)
+#define SEGMENT_ENTRIES4(s) SEGMENT_ENTRY(s), SEGMENT_ENTRY(s+1), SEGMENT_ENTRY(s+2), SEGMENT_ENTRY(s+3)
+
+PROGMEM const byte segmentTable[32] = {
+  SEGMENT_ENTRIES4(0),  SEGMENT_ENTRIES4(4),  SEGMENT_ENTRIES4(8),  SEGMENT_ENTRIES4(12),
+  SEGMENT_ENTRIES4(16), SEGMENT_ENTRIES4(20), SEGMENT_ENTRIES4(24), SEGMENT_ENTRIES4(28)
+};
+
+/* Feeds the bit at the given position of a frame to the decoder */
+static void decode_bit(FrameDecoder &d, byte bit, int pos)
+{
+  switch(d.state) 
+  {
+    case DECODE_LEADING:
+      /* The data starts with a run of zeros, and the first 1 bit starts the start segment */
+      if (bit == 0) {
+        if (pos >= LEADING_ZEROS + SLIP_BITS) {
+          d.error = CARD_INVALID_START;
+          d.state = DECODE_FINISHED;
+        }
+      } else if (pos < LEADING_ZEROS - SLIP_BITS) {
+        d.error = CARD_LEADING_ZEROS;
+        d.state = DECODE_FINISHED;
+      } else {
+        d.startBit = pos;
+        d.slipped = (d.startBit != LEADING_ZEROS);
+        d.segment = 1;
+        d.segmentBits = 1;
+        d.state = DECODE_START;
+      }
+      return;
+
+    case DECODE_START:
+    case DECODE_DATA:
+    case DECODE_LRC:
+    {
+      /* Collect the next 5-bit segment (sent LSB first) */
+      d.segment |= (bit << d.segmentBits);
+      if (++d.segmentBits < SEGMENT_BITS) {
+        break;
+      }
+      byte entry = pgm_read_byte(&segmentTable[d.segment]);
+      byte block = entry & SEGMENT_BLOCK_MASK;
+      d.segment = 0;
+      d.segmentBits = 0;
+
+      /* Verify the parity bit (odd parity) */
+      if (!(entry & SEGMENT_VALID)) {
+        d.error = (d.state == DECODE_LRC) ? CARD_LRC_PARITY_FAILURE : CARD_PARITY_FAILURE;
+        d.state = DECODE_FINISHED;
+      } else if (d.state == DECODE_START) {
+        /* The first segment should be 0xB == 1011B */
+        if (!(entry & SEGMENT_IS_START)) {
+          d.error = CARD_INVALID_START;
+          d.state = DECODE_FINISHED;
+        } else {
+          d.lrc = block;
+          d.state = DECODE_DATA;
+        }
+      } else if (d.state == DECODE_LRC) {
+        /* The LRC is the XOR of every block from the start to the end segment */
+        if (block != d.lrc) {
+          d.error = CARD_LRC_FAILURE;
+          d.state = DECODE_FINISHED;
+        } else {
+          /* The card data is complete. The trailing zeros are ignored, so the card can be 
+           * handled while they are still clocking in. */
+          d.error = CARD_SUCCESS;
+          d.state = DECODE_TRAILING;
+        }
+      } else if (entry & SEGMENT_IS_END) {
+        /* End of data sequence, the LRC follows */
+        d.lrc ^= block;
+        d.state = DECODE_LRC;
+      } else if (block & SEGMENT_PAD_BIT) {
+        d.error = CARD_PAD_FAILURE;
+        d.state = DECODE_FINISHED;
+      } else if (d.resultHigh & 0xE0) {
+        /* The payload is longer than any format we know (see CardFormat.h) */
+        d.error = CARD_UNKNOWN_FORMAT;
+        d.state = DECODE_FINISHED;
+      } else {
+        /* Shift another 3 bits into the result buffer */
+        d.lrc ^= block;
+        d.resultHigh = (d.resultHigh << 3) | (byte)(d.result >> 29);
+        d.result = (d.result << 3) | (block & SEGMENT_PAYLOAD);
+      }
+      break;
+    }
+  }
 
-// Macro to verify odd parity
-#define ODD_PARITY(d0,d1,d2,d3,parity)   (((d0)+(d1)+(d2)+(d3)+(parity)) % 2 == 1)
+  if (pos == CARD_NUM_BITS-1 && d.state < DECODE_TRAILING) {
+    /* The data ended without seeing a 0xF segment */
+    d.error = CARD_PREMATURE_END;
+    d.state = DECODE_FINISHED;
+  }
+}
 
 /**************/
 /* CardReader */
@@ -66,195 +210,164 @@
 
 CardReader::CardReader()
 {
-  bitsRead = 0;
+  bitTimeout = DEFAULT_BIT_TIMEOUT*1000UL;
+  timeouts = 0;
+  framesDropped = 0;
+  framesQueuedMax = 0;
+  framesRecovered = 0;
+  beepHead = 0;
+  beepTail = 0;
+  beepStep = NULL;
+  beepCountdown = 0;
+  beepOn = false;
+  frameHead = 0;
+  frameTail = 0;
+  frameCount = 0;
+  resetFrame();
 }
 
-void CardReader::begin(int data, int clock, int present, int beep)
+void CardReader::begin()
 {
-  dataPin = data;
-  clockPin = clock;
-  presentPin = present;
-  beepPin = beep;
   // Set the pins to input mode
-  pinMode(clockPin, INPUT);
-  pinMode(dataPin, INPUT);
-  pinMode(presentPin, INPUT);
-  pinMode(beepPin, OUTPUT);
+  ClockPin::input();
+  DataPin::input();
+  PresentPin::input();
+  BeepPin::output();
   // Turn off beep by default
-  digitalWrite(beepPin, HIGH);
+  BeepPin::high();
   clearCardData();
 }
 
-/*
 boolean CardReader::isCardPresent()
 {
-  return (digitalRead(presentPin) == LOW);
-}*/
+  return !PresentPin::read();
+}
 
-int CardReader::readCard(unsigned int &facility, unsigned int &card)
+int CardReader::readCard(cardkey_t &key)
 {
-    int data = 0, d0, d1, d2, d3, parity, n;
-    int pos = 0;
-    
-    if (!hasCardData()) {
-      // Actually no data to read
-      return CARD_NO_DATA;
-    }
-
-    /* Skip the first 25 bits of data (make sure they are zeros) */
-    for (n = 0; n < 25; n++)
-    {
-        data = getData(pos++);
-        if (data != 0) {
-            /* Error */
-            return CARD_LEADING_ZEROS;
-            //Serial.println("leading zeros expected\n");
-        }
-    }
-
-    /* Read in groups of 5-bits */
-    boolean start = true;
-    int startpos = -1;
-    /* The variable which will hold the facility code (8 bits) and 
-     * the card number (16 bits) */
-    unsigned long result = 0;
-    while (1) 
-    {
-        /* The bits are sent LSB first */
-        d0 = getData(pos++);
-        d1 = getData(pos++);
-        d2 = getData(pos++);
-        d3 = getData(pos++);
-        parity = getData(pos++);
-
-        if (d0 == -1 || d1 == -1 || d2 == -1 || d3 == -1 || parity == -1) {
-          /* The data ended without seeing a 0xF segment */
-          return CARD_PREMATURE_END;
-        }
-
-        /* Verify the parity bit (odd parity) */
-        if (!ODD_PARITY(d0,d1,d2,d3,parity)) {
-          //Serial.println("parity failure on 5-bit chunk\n");
-          return CARD_PARITY_FAILURE;
-        }
-
-        if (start) {
-            /* The first segment should be 0xB == 1011B */
-            if (! (d0 & d1 & !d2 & d3) ) {
-              /* Invalid starting segment */
-              return CARD_INVALID_START;
-            }
-            startpos = pos;
-            start = false;
-            continue;
-        } 
-
-        /* Check for the ending segment 0xF == 1111B */
-        if (d0 & d1 & d2 & d3)
-        {
-            /* End of data sequence, the LRC follows */
-            d0 = getData(pos++);
-            d1 = getData(pos++);
-            d2 = getData(pos++);
-            d3 = getData(pos++);
-            parity = getData(pos++);
-            if (!ODD_PARITY(d0,d1,d2,d3,parity)) {
-                //Serial.println("LRC parity failure\n");
-                return CARD_LRC_PARITY_FAILURE;
-            }
-
-            /* The parity for LRC checks out, verify the actual LRC calculation */
-
-            /* Consume the remaining zeros */
-            while (1) {
-                data = getData(pos++);
-                if (data == -1) {
-                    break;
-                }
-                if (data != 0) {
-                  //Serial.println("trailing data must be zeros\n");
-                  return CARD_TRAILING_ZEROS;
-                }
-            }
-            /* That is the end of the card data stream */
-            break;
-        }
+  if (!hasCardData()) {
+    // Actually no data to read
+    return CARD_NO_DATA;
+  }
+  /* Take the oldest frame from the queue (it is removed by clearCardData) */
+  volatile CardFrame &frame = frames[frameHead];
+  if (frame.error != CARD_SUCCESS) {
+    // The reader might have slipped a bit at the start of the frame
+    resyncFrame();
+  }
+  if (frame.error != CARD_SUCCESS) {
+    return frame.error;
+  }
+  unsigned long payload = frame.payload;
+  byte payloadHigh = frame.payloadHigh;
 
-        if (d3 != 0) {
-            //Serial.println("data segments must have zero padding\n");
-            return CARD_PAD_FAILURE;
-        }
+  /* Pick the decoder by the length of the card data */
+  CardFormat format;
+  if (!find_card_format(payload, payloadHigh, format)) {
+    return CARD_UNKNOWN_FORMAT;
+  }
+  if (!format.decode(payload, payloadHigh, key)) {
+    return CARD_FORMAT_PARITY;
+  }
+  return CARD_SUCCESS;
+}
 
-        /* Shift another 3 bits into the result buffer */
-        result = (result << 1) | d2;
-        result = (result << 1) | d1;
-        result = (result << 1) | d0;
-    }
+int CardReader::readCard(unsigned int &facility, unsigned long &card)
+{
+  cardkey_t key;
 
-    /* Mask out everything except the final 26 bits (LSB) */
-    //result = result & 0x3FFFFFFL;
-
-    /* Check the data parity (first and last bits) */
-
-    // Shift out the end parity bit. We can ignore the upper parity bit
-    result >>= 1;
-    // Mask out the upper parity bit (not really necessary)
-    //result = result & 0xFFFFFF;
-    
-    /* Extract the facility ID */
-    facility = (result >> 16) & 0xFF;
-    /* Extract the card ID */
-    card = result & 0xFFFF;
-    return CARD_SUCCESS;
+  int ret = readCard(key);
+  if (ret != CARD_SUCCESS) {
+    return ret;
+  }
+  facility = KEY_FACILITY(key);
+  card = KEY_CARD(key);
+  return CARD_SUCCESS;
 }
 
 int CardReader::readCard(char *serial, int maxlen)
 {
-  unsigned int facility;
-  unsigned int card;
+  cardkey_t key;
 
   /* Make sure the serial buffer is large enough */
   if (maxlen < READER_SERIAL_BUF_LEN) {
     return CARD_BUFFER_TOO_SMALL;
   }
 
-  /* Read the facility and card numbers */
-  int ret = readCard(facility, card);
+  int ret = readCard(key);
   if (ret != CARD_SUCCESS) {
     return ret;
   }
 
   /* Translate the card data into a serial number of the form "facility-card". */
-  sprintf(serial, "%03u-%05u", facility, card);
+  format_serial(key, serial);
   return CARD_SUCCESS;
 }
 
-void CardReader::beep(int duration)
+boolean CardReader::playBeep(const unsigned int *pattern)
 {
-  digitalWrite(beepPin, LOW);
-  delay(duration);
-  digitalWrite(beepPin, HIGH);
+  byte next = (beepTail + 1) & (BEEP_QUEUE_LEN-1);
+  if (next == beepHead) {
+    // Already plenty of beeping to do
+    return false;
+  }
+  beepQueue[beepTail] = pattern;
+  // Hand the pattern over to the timer interrupt
+  beepTail = next;
+  return true;
+}
+
+void CardReader::playStartupBeep()
+{
+  playBeep(beepStartup);
 }
 
 void CardReader::playFailBeep()
 {
-  for(int n = 0; n < 3; n++)
-  {
-    beep(200);
-    delay(200);
-  }
+  playBeep(beepFail);
 }
 
 void CardReader::playTestBeep()
 {
-  // Beep test. Short beep
-  beep(200);
-  delay(200);
-  // Long beep
-  beep(400);
-  delay(400);
-  // Short beep
-  beep(200);
+  playBeep(beepTest);
+}
+
+void CardReader::tick(unsigned int ms)
+{
+  /* Count down the current beep or gap */
+  if (beepCountdown > ms) {
+    beepCountdown -= ms;
+    return;
+  }
+  beepCountdown = 0;
+
+  if (beepOn) 
+  {
+    /* The beep is over, so on to the gap after it */
+    BeepPin::high();
+    beepOn = false;
+    beepCountdown = pgm_read_word(beepStep+1);
+    beepStep += 2;
+    if (beepCountdown > 0) {
+      return;
+    }
+  }
+
+  if (beepStep == NULL || pgm_read_word(beepStep) == 0) 
+  {
+    /* The pattern is finished, so start on the next one */
+    if (beepHead == beepTail) {
+      beepStep = NULL;
+      return;
+    }
+    beepStep = beepQueue[beepHead];
+    beepHead = (beepHead + 1) & (BEEP_QUEUE_LEN-1);
+  }
+
+  /* Start the next beep (the beep pin is active low) */
+  BeepPin::low();
+  beepOn = true;
+  beepCountdown = pgm_read_word(beepStep);
 }
 
 const prog_char *CardReader::getErrorStr(int code)
@@ -270,73 +383,208 @@ const prog_char *CardReader::getErrorStr(int code)
       return strInvalidBegin;
     case CARD_LRC_FAILURE:
       return strLRCFail;
+    case CARD_LRC_PARITY_FAILURE:
+      return strLRCParityFail;
     case CARD_TRAILING_ZEROS:
       return strTrailingZeros;
     case CARD_PAD_FAILURE:
       return strPaddingFail;
     case CARD_LEADING_ZEROS:
       return strLeadingZeros;
+    case CARD_UNKNOWN_FORMAT:
+      return strUnknownFormat;
+    case CARD_FORMAT_PARITY:
+      return strFormatParityFail;
   }
   return strUnknown;
 }
 
 void CardReader::receiveCardData()
 {
-  if (bitsRead == CARD_BUFFER_LEN)
+  unsigned long now = micros();
+  /* A long enough gap since the last bit means this bit starts a new frame */
+  checkTimeout(now);
+
+  if (decoder.state >= DECODE_TRAILING)
   {
-    /* The card buffer is full, signal an error */
-    /* ... */
+    /* The rest of a frame that has already been decoded. Keep track of the time so we know 
+     * when the frame ends. */
+    lastBitTime = now;
   }
-  else if (digitalRead(presentPin) == LOW)
+  else if (!PresentPin::read())
   {
-    if (bufferPos >= 0 && bufferPos < CARD_BUFFER_LEN) {
-      data[bufferPos++] = digitalRead(dataPin);
-      bitsRead++;
+    lastBitTime = now;
+    if (bitsRead == 0) {
+      /* A new frame, which is only kept if there is a free slot to receive it into */
+      frameStored = (frameCount < FRAME_QUEUE_LEN);
+      if (frameStored) {
+        memset((void*)frames[frameTail].data, 0, CARD_BUFFER_LEN);
+      }
+    }
+    /* The buffer starts out zeroed, so only the set bits need storing */
+    byte level = DataPin::read();
+    if (level && frameStored) {
+      frames[frameTail].data[bitsRead >> 3] |= (1 << (bitsRead & 7));
+    }
+    if (decoder.state != DECODE_STORE) {
+      // The data line is active low
+      decode_bit(decoder, 1-level, bitsRead);
+    }
+    bitsRead++;
+    if (decoder.state == DECODE_FINISHED && frameStored && bitsRead < CARD_NUM_BITS) {
+      /* The frame might still decode if the reader slipped a bit. That is left to the main loop 
+       * (see resyncFrame), which needs the rest of the bits. */
+      decoder.state = DECODE_STORE;
+    } else if (decoder.state == DECODE_STORE && bitsRead == CARD_NUM_BITS) {
+      decoder.state = DECODE_FINISHED;
+    }
+    if (decoder.state >= DECODE_TRAILING) {
+      // The decoder has finished with the frame
+      queueFrame();
     }
   }
 }
 
-void CardReader::clearCardData() 
+void CardReader::queueFrame()
+{
+  if (!frameStored) {
+    /* The queue was full (the main loop is busy) so the card is lost */
+    framesDropped++;
+    return;
+  }
+  if (decoder.error == CARD_SUCCESS && decoder.slipped) {
+    framesRecovered++;
+  }
+  /* The bits are already in the slot */
+  volatile CardFrame &frame = frames[frameTail];
+  frame.error = decoder.error;
+  frame.payload = decoder.result;
+  frame.payloadHigh = decoder.resultHigh;
+  frame.bits = bitsRead;
+  frame.time = lastBitTime;
+  // Publish the frame to the main loop. The next frame is received into the next slot.
+  frameTail = (frameTail + 1) % FRAME_QUEUE_LEN;
+  frameCount++;
+  if (frameCount > framesQueuedMax) {
+    framesQueuedMax = frameCount;
+  }
+}
+
+boolean CardReader::checkTimeout(unsigned long now)
+{
+  if (bitsRead == 0 || now - lastBitTime <= bitTimeout) {
+    // No frame, or the frame is still arriving
+    return false;
+  }
+  if (decoder.state == DECODE_STORE) {
+    // A frame that didn't decode has ended, so hand it over to be tried again
+    queueFrame();
+  } else if (decoder.state < DECODE_TRAILING) {
+    /* The card stopped sending before the decoder had finished (eg the swipe was interrupted),
+     * so throw the partial frame away */
+    timeouts++;
+  }
+  resetFrame();
+  return true;
+}
+
+void CardReader::resetFrame()
 {
   bitsRead = 0;
-  bufferPos = 0;
-  bytePos = 0;
-  bitPos = 0;
-  // Zero out the card buffer
-  memset(data, 0, CARD_BUFFER_LEN);
+  memset(&decoder, 0, sizeof(decoder));
+  decoder.state = DECODE_LEADING;
+  decoder.error = CARD_NO_DATA;
+  // The slot for the next frame is picked (and zeroed) when its first bit arrives
+  frameStored = false;
+}
+
+void CardReader::clearCardData() 
+{
+  /* Only the main loop moves the head of the queue, but the interrupt also changes the count */
+  if (frameCount > 0) {
+    frameHead = (frameHead + 1) % FRAME_QUEUE_LEN;
+    noInterrupts();
+    frameCount--;
+    interrupts();
+  }
 }
 
 boolean CardReader::hasCardData() 
 {
-  return bitsRead == CARD_NUM_BITS;
+  /* Throw away partial frames from the reader */
+  noInterrupts();
+  checkTimeout(micros());
+  interrupts();
+  return (frameCount > 0);
+}
+
+int CardReader::getFrameBits()
+{
+  if (frameCount == 0) {
+    return 0;
+  }
+  return frames[frameHead].bits;
+}
+
+int CardReader::getFrameData(int pos)
+{
+  if (pos >= 0 && pos < getFrameBits()) {
+    // The data line is active low
+    return 1-((frames[frameHead].data[pos >> 3] >> (pos & 7)) & 0x1);
+  }
+  return -1;
+}
+
+void CardReader::resyncFrame()
+{
+  volatile CardFrame &frame = frames[frameHead];
+  int numBits = frame.bits;
+  FrameDecoder d;
+  for (int start = LEADING_ZEROS - SLIP_BITS; start <= LEADING_ZEROS + SLIP_BITS; start++)
+  {
+    if (getFrameData(start) != 1) {
+      continue;
+    }
+    /* Decode the stored bits as if the start segment began here. The segment parity and LRC 
+     * have to check out as usual for the frame to be accepted. */
+    memset(&d, 0, sizeof(d));
+    d.state = DECODE_LEADING;
+    for (int pos = start; pos < numBits && d.state < DECODE_TRAILING; pos++) {
+      decode_bit(d, getFrameData(pos), pos);
+    }
+    if (d.state == DECODE_TRAILING) {
+      frame.error = CARD_SUCCESS;
+      frame.payload = d.result;
+      frame.payloadHigh = d.resultHigh;
+      // The interrupt counts recovered frames too
+      noInterrupts();
+      framesRecovered++;
+      interrupts();
+      return;
+    }
+  }
+  // Nothing else to try, so the frame keeps the error from the first attempt
+}
+
+unsigned long CardReader::getFrameTime()
+{
+  if (frameCount == 0) {
+    return 0;
+  }
+  return frames[frameHead].time;
 }
 
 void CardReader::printBuffer(Stream &stream)
 {
-  // Dump the contents of the reader buffer
-  int numBits = bitsRead;
+  // Dump the bits of the oldest frame
+  int numBits = getFrameBits();
   char ch;
   for (int n = 0; n < numBits; n++) 
   {
-    if (getData(n) == 1) ch = '1';
+    if (getFrameData(n) == 1) ch = '1';
     else ch = '0';
     stream.print(ch);
   }
   stream.println("");
 }
 
-int CardReader::getData(int pos)
-{
-  if (pos >= 0 && pos < CARD_BUFFER_LEN)
-    return 1-data[pos];
-  return -1;
-  /* 
-  byte = pos/8;
-  bit = pos%8;
-  if (byte < CARD_BUFFER_LEN) {
-    return 1-((data[byte] >> bit)&0x1);
-  }
-  return -1;
-  */
-}
-
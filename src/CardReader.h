@@ -21,6 +21,7 @@
 
 #include <avr/pgmspace.h>
 #include "Arduino.h"
+#include "CardKey.h"
 
 #define CARD_SUCCESS              0
 #define CARD_PREMATURE_END       -1
@@ -33,60 +34,177 @@
 #define CARD_LEADING_ZEROS       -8
 #define CARD_BUFFER_TOO_SMALL    -9
 #define CARD_NO_DATA            -10
+#define CARD_UNKNOWN_FORMAT     -11
+#define CARD_FORMAT_PARITY      -12
 
-#define CARD_BUFFER_LEN         255
+/* The most bits buffered from a single card */
 #define CARD_NUM_BITS           255
+/* The card bits are packed eight to a byte */
+#define CARD_BUFFER_LEN         ((CARD_NUM_BITS+7)/8)
 
-/* We allocate a buffer of size 10 chars, since serial numbers are made from a three digit facility code,
- * then a dash, then a 5 digit card code, with an extra byte for null. */
-#define READER_SERIAL_BUF_LEN    10
+/* A frame ends when no clock pulses arrive for this long (ms). The reader clocks a bit about 
+ * every 1.5ms while a card is present. */
+#define DEFAULT_BIT_TIMEOUT      20
+
+/* The number of decoded frames that can wait for the main loop. Each frame is received straight 
+ * into the next free slot, so a swipe is only lost if every slot is still waiting when it starts. 
+ * Each slot takes 44 bytes of SRAM. */
+#define FRAME_QUEUE_LEN          2
+
+/* The number of beep patterns that can wait to be played (a power of two, holding one less) */
+#define BEEP_QUEUE_LEN           4
+
+/* The buffer for a serial number must hold the long form (see CardKey.h) with an extra byte for null */
+#define READER_SERIAL_BUF_LEN    (SERIAL_LEN+1)
+
+/* The result of decoding a frame of card data. The payload is left for the main loop to decode 
+ * according to the card format (see CardFormat.h). The bits received are kept with it, so they
+ * can be logged if the frame didn't decode. */
+struct CardFrame
+{
+  unsigned long payload;
+  byte payloadHigh;
+  int error;
+  /* The bits received from the reader, packed LSB first (bit n is stored in data[n/8]) */
+  unsigned char data[CARD_BUFFER_LEN];
+  byte bits;
+  /* When the last bit of the frame arrived (micros) */
+  unsigned long time;
+};
+
+/* The state of the streaming decoder, following the layout of the card data (see CardReader.cpp) */
+struct FrameDecoder
+{
+  /* One of the DECODE_* values in CardReader.cpp */
+  byte state;
+  /* The bits of the current 5-bit segment received so far (d0 first) */
+  byte segment;
+  byte segmentBits;
+  /* The payload bits decoded so far (the last 32, and the 8 before them) */
+  unsigned long result;
+  byte resultHigh;
+  /* The running LRC (XOR) of the blocks decoded so far */
+  byte lrc;
+  /* Where the start segment of the frame begins, and whether that isn't where it should be */
+  byte startBit;
+  boolean slipped;
+  /* The result of decoding the frame, once the decoder is finished with it */
+  int error;
+};
 
 class CardReader
 {
   private:
-    int dataPin;
-    int clockPin;
-    int presentPin;
-    int beepPin;
-
-    unsigned char data[CARD_BUFFER_LEN];
-    int bufferPos;
-    int bytePos;
-    int bitPos;
+    /* The decoder for the frame being received. It is fed each bit from the interrupt as it 
+     * arrives, so the card is known as soon as the LRC has been received. The main loop only 
+     * touches it with interrupts disabled. */
+    FrameDecoder decoder;
+    /* When the last bit of the frame arrived (micros) */
+    volatile unsigned long lastBitTime;
+
+    /* Ends the current frame if the reader has stopped sending bits. Returns true if
+     * the frame was ended. Call with interrupts disabled. */
+    boolean checkTimeout(unsigned long now);
+
+    /* Clears the buffer and decoder ready for the next frame */
+    void resetFrame();
+    /* Tries decoding the oldest frame again from each place the start segment could begin, in 
+     * case the reader slipped a bit. Called from the main loop when the frame didn't decode. */
+    void resyncFrame();
+
+    /* Decoded frames waiting for the main loop. The interrupt adds frames at the tail, and the main
+     * loop takes them from the head. Every slot can hold a waiting frame; while one is free, the 
+     * slot at the tail holds the bits of the frame being received. */
+    volatile CardFrame frames[FRAME_QUEUE_LEN];
+    volatile byte frameHead;
+    volatile byte frameTail;
+    volatile byte frameCount;
+    /* Whether the frame being received has a slot to go in (the queue wasn't full when it started) */
+    volatile boolean frameStored;
+
+    /* Adds the decoded frame to the queue (called from the interrupt) */
+    void queueFrame();
+
+    /* Beep patterns waiting to be played (see playBeep). The main loop adds patterns at the tail 
+     * and the timer interrupt takes them from the head. */
+    const unsigned int * volatile beepQueue[BEEP_QUEUE_LEN];
+    volatile byte beepHead;
+    volatile byte beepTail;
+    /* The step of the pattern being played, and the time left in the beep or gap after it (ms) */
+    const unsigned int *beepStep;
+    unsigned int beepCountdown;
+    boolean beepOn;
     
   public:
     CardReader();
 
-    /* Number of bits read after calling readCard */
-    int bitsRead;
+    /* Number of bits received in the current frame */
+    volatile int bitsRead;
+
+    /* The gap between bits (microseconds) after which a frame is considered finished */
+    unsigned long bitTimeout;
 
-    /* Call 'begin' before using the card reader and pass in the connected pins */
-    void begin(int data, int clock, int present, int beep);
+    /* The number of partial frames thrown away because the reader stopped sending bits */
+    volatile unsigned int timeouts;
+
+    /* The number of cards lost because the frame queue was full, and the most frames that
+     * have been waiting at once */
+    volatile unsigned int framesDropped;
+    volatile byte framesQueuedMax;
+
+    /* The number of cards decoded after finding the start segment out of place */
+    volatile unsigned int framesRecovered;
+
+    /* Call 'begin' before using the card reader. The reader is connected to the PIN_* pins in Pins.h */
+    void begin();
 
     static const prog_char *getErrorStr(int code);
 
-    /* Reads the card present pin to determine if a card is being swipped */
-    //boolean isCardPresent();
+    /* Reads the card present pin to determine if a card is being swipped. The reader asserts
+     * this before the first bit of card data is clocked out. */
+    boolean isCardPresent();
 
-    /* Reads card data and returns the facility ID and card ID. On success
-     * this function returns 0, otherwise it returns the error code. */
-    int readCard(unsigned int &facility, unsigned int &card);
+    /* Decodes the oldest frame of card data as a packed card key, using the format matching the 
+     * length of the card data. On success this function returns 0, otherwise it returns the 
+     * error code. */
+    int readCard(cardkey_t &key);
+
+    /* Reads the facility ID and card ID */
+    int readCard(unsigned int &facility, unsigned long &card);
 
     /* Reads the card data and copies it into the serial buffer */
     int readCard(char *serial, int maxlen);
     
-    void beep(int duration);
+    /* Queues a beep pattern to be played once the patterns before it have finished. The pattern 
+     * is stored in PROGMEM as pairs of beep and gap lengths (ms), ending with a zero beep length. 
+     * Returns false if the queue is full. */
+    boolean playBeep(const unsigned int *pattern);
+
+    /* Queues one of the standard beep patterns. These return straight away. */
+    void playStartupBeep();
     void playFailBeep();
     void playTestBeep();
+
+    /* Plays the queued beep patterns. Called from the timer interrupt every 'ms' milliseconds. */
+    void tick(unsigned int ms);
     
     void receiveCardData();
 
+    /* Removes the oldest frame from the queue, once it has been handled */
     void clearCardData();
+    /* Returns whether a decoded frame (either successful or not) is waiting in the queue */
     boolean hasCardData();
 
-    void printBuffer(Stream&);
+    /* The number of bits received in the oldest frame, and each of those bits (0 or 1, or -1 
+     * past the end of the frame). Bits after the card data (the trailing zeros) aren't kept. */
+    int getFrameBits();
+    int getFrameData(int pos);
 
-    int getData(int pos);
+    /* The time (micros) the last bit of the oldest frame arrived */
+    unsigned long getFrameTime();
+
+    /* Prints the bits received in the oldest frame */
+    void printBuffer(Stream&);
 };
 
 #endif
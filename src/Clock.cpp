@@ -35,11 +35,48 @@ Clock::Clock()
   day = 1;
   month = 1;
   year = 0;
+  epoch = 0;
+  slewSeconds = 0;
+  skipTick = false;
+  lastSync = 0;
+  syncInterval = CLOCK_DEFAULT_SYNC;
+  synced = false;
+  drift = 0;
 }
 
-boolean Clock::update()
+void Clock::setEpoch(unsigned long value)
+{
+  noInterrupts();
+  epoch = value;
+  slewSeconds = 0;
+  interrupts();
+}
+
+unsigned long Clock::now()
+{
+  noInterrupts();
+  unsigned long value = epoch;
+  interrupts();
+  return value;
+}
+
+void Clock::tick()
+{
+  if (slewSeconds > 0) {
+    /* Run at half speed until the RTC catches up */
+    skipTick = !skipTick;
+    if (skipTick) {
+      slewSeconds--;
+      return;
+    }
+  }
+  epoch++;
+}
+
+boolean Clock::sync()
 {
   boolean ret = false;
+  DateTime time;
   Wire.beginTransmission(RTC_ADDRESS);
   Wire.write((byte)0);
   Wire.endTransmission();
@@ -47,55 +84,79 @@ boolean Clock::update()
   Wire.requestFrom(RTC_ADDRESS, 7);
   if (Wire.available() > 0) 
   {
-    seconds = decodeBCD(Wire.read());
-    minutes = decodeBCD(Wire.read());
-    hours = decodeBCD(Wire.read());
+    time.seconds = decodeBCD(Wire.read());
+    time.minutes = decodeBCD(Wire.read());
+    time.hours = decodeBCD(Wire.read());
     weekday = decodeBCD(Wire.read());
-    day = decodeBCD(Wire.read());
-    month = decodeBCD(Wire.read());
-    year = decodeBCD(Wire.read());
+    time.day = decodeBCD(Wire.read());
+    time.month = decodeBCD(Wire.read());
+    time.year = decodeBCD(Wire.read());
     ret = true;
   }
 
+  /* Try again after the usual interval, even if the chip couldn't be read */
+  lastSync = now();
+  if (!ret) {
+    return false;
+  }
+
   /* Make sure the time data makes sense */
   /* TODO - log inconsistent data */
-  if (year > 99) year = 0;
-  if (month > 12) month = 1;
-  if (day > 31) day = 1;
-  if (hours > 24) hours = 0;
-  if (minutes > 60) minutes = 0;
-  if (seconds > 60) seconds = 0;
-  return ret;
+  if (time.year > 99) time.year = 0;
+  if (time.month > 12) time.month = 1;
+  if (time.day > 31) time.day = 1;
+  if (time.hours > 24) time.hours = 0;
+  if (time.minutes > 60) time.minutes = 0;
+  if (time.seconds > 60) time.seconds = 0;
+
+  unsigned long rtc = date_to_epoch(time);
+  unsigned long current = now();
+  drift = synced ? (long)(current - rtc) : 0;
+  if (synced && current > rtc) {
+    /* The software clock is running fast. Slow it down until the RTC catches up, however far 
+     * ahead it is, so the timestamps in the log never go backwards (the log query relies on 
+     * that to stop early). Only setting the time by hand steps the clock back. */
+    noInterrupts();
+    slewSeconds = current - rtc;
+    interrupts();
+  } else {
+    setEpoch(rtc);
+  }
+  synced = true;
+  lastSync = rtc;
+  update();
+  return true;
+}
+
+void Clock::poll()
+{
+  if (now() - lastSync >= syncInterval) {
+    sync();
+  }
+}
+
+void Clock::update()
+{
+  DateTime time;
+  epoch_to_date(now(), time);
+  year = time.year;
+  month = time.month;
+  day = time.day;
+  hours = time.hours;
+  minutes = time.minutes;
+  seconds = time.seconds;
 }
 
 boolean Clock::setDateTime(char *buf)
 {
-  const char *delims = ":-/ ";
-  char *str;
-  
-  str = strtok(buf, delims);
-  if (str == NULL) return false;
-  year = atoi(str);
-  
-  str = strtok(NULL, delims);
-  if (str == NULL) return false;
-  month = atoi(str);
-  
-  str = strtok(NULL, delims);
-  if (str == NULL) return false;
-  day = atoi(str);
-  
-  str = strtok(NULL, delims);
-  if (str == NULL) return false;
-  hours = atoi(str);
-  
-  str = strtok(NULL, delims);
-  if (str == NULL) return false;
-  minutes = atoi(str);
-  
-  str = strtok(NULL, delims);
-  if (str == NULL) return false;
-  seconds = atoi(str);
+  DateTime time;
+  if (parse_date_time(buf, time) != 6) return false;
+  year = time.year;
+  month = time.month;
+  day = time.day;
+  hours = time.hours;
+  minutes = time.minutes;
+  seconds = time.seconds;
   
   Wire.beginTransmission(RTC_ADDRESS);
   Wire.write((byte)0);
@@ -107,14 +168,29 @@ boolean Clock::setDateTime(char *buf)
   Wire.write(encodeBCD(month));
   Wire.write(encodeBCD(year));
   Wire.endTransmission();
+
+  /* Start the software clock from the new time as well */
+  unsigned long value = date_to_epoch(time);
+  setEpoch(value);
+  synced = true;
+  lastSync = value;
   return true;
 }
 
+void Clock::getDateTime(DateTime &time)
+{
+  time.year = year;
+  time.month = month;
+  time.day = day;
+  time.hours = hours;
+  time.minutes = minutes;
+  time.seconds = seconds;
+}
+
 void Clock::formatDateTime(char *buf, int buflen)
 {
-  // Make sure the buffer is large enough to fit the data
-  if (buflen >= 20) {
-    sprintf(buf, "20%02d/%02d/%02d %02d:%02d:%02d ", year, month, day, hours, minutes, seconds);
-  }
+  DateTime time;
+  getDateTime(time);
+  format_date_time(time, buf, buflen);
 }
 
@@ -18,10 +18,30 @@
 #ifndef __CLOCK_H__
 #define __CLOCK_H__
 
-/* The interface to the realtime clock chip (DS3234). It uses the SPI library to interface with the bus. The
- * bus is shared with the SD card reader so we have to be careful when using it. */
+#include "DateTime.h"
+
+/* The default time (seconds) between resynchronizing the software clock with the RTC chip */
+#define CLOCK_DEFAULT_SYNC     3600
+
+/* The interface to the realtime clock chip on the I2C bus. Reading the chip takes a whole
+ * bus transaction, so the time is kept in software as the number of seconds since 2000 (see
+ * 'date_to_epoch'), advanced by the timer interrupt calling 'tick'. The chip is only read at boot 
+ * and once every 'syncInterval' seconds, to correct the software clock. */
 class Clock
 {
+  private:
+    /* Seconds since 2000, advanced by 'tick' (so only read/written with interrupts off) */
+    volatile unsigned long epoch;
+    /* The number of seconds the software clock is ahead of the RTC. While this is non-zero every 
+     * other tick is skipped, so the RTC catches up without the clock ever going backwards. */
+    volatile unsigned long slewSeconds;
+    volatile boolean skipTick;
+    /* The value of 'now' when the software clock was last resynchronized (or the RTC read failed) */
+    unsigned long lastSync;
+
+    /* Sets the software clock (with interrupts off) */
+    void setEpoch(unsigned long value);
+
   public:
     Clock();
     
@@ -35,15 +55,41 @@ class Clock
     byte day;
     byte month;
     byte year;
+
+    /* How often (seconds) the software clock is resynchronized with the RTC chip, set from the config */
+    unsigned long syncInterval;
+
+    /* Whether the last read of the RTC worked, and how far (seconds) the software clock had 
+     * drifted from it. Positive means the software clock was ahead. */
+    boolean synced;
+    long drift;
+
+    /* Returns the current time as seconds since 2000. This is cheap enough to timestamp 
+     * anything with. */
+    unsigned long now();
+
+    /* Advances the software clock. Called once a second from the timer interrupt. */
+    void tick();
+
+    /* Reads the time from the RTC chip and resets the software clock to it. Returns false if the
+     * chip couldn't be read. */
+    boolean sync();
+
+    /* Resynchronizes with the RTC chip if 'syncInterval' has passed since the last time. Call
+     * this from the main loop when the bus isn't busy. */
+    void poll();
   
-    /* Update the stored time to the current time on the RTC chip */
-    boolean update();
+    /* Update the stored time (the fields above) to the current time, from the software clock */
+    void update();
 
     /* Sets the date and time on the RTC given an input string. The string should look 
      * like "YY-MM-DD HH:MM:SS". This function returns true if the string parses correctly, 
      * false otherwise. Note that 'buf' is modified in either case. */
     boolean setDateTime(char *buf);
 
+    /* Copies the date and time from the last call to 'update' */
+    void getDateTime(DateTime &time);
+
     /* Format the date/time in the buffer. If the buffer is not long enough (minimum 20 chars)
      * this function does nothing. */
     void formatDateTime(char *buf, int len);
@@ -1,6 +1,8 @@
 #ifndef __CONST_H__
 #define __CONST_H__
 
+#include "Features.h"
+
 /***********/
 /* Strings */
 /***********/
@@ -23,8 +25,25 @@ PROGMEM const prog_char strSDCardStatus[] = {"SD enabled: "};
 PROGMEM const prog_char strDoorStatus[] = {"Door locked: "};
 PROGMEM const prog_char strOpenHouseStatus[] = {"Open house: "};
 PROGMEM const prog_char strDateStatus[] = {"Date/time: "};
+PROGMEM const prog_char strClockSyncStatus[] = {"RTC read: "};
+PROGMEM const prog_char strClockDriftStatus[] = {", drift at last sync: "};
 PROGMEM const prog_char strDoorLenStatus[] = {"Door entry len: "};
 PROGMEM const prog_char strOpenLenStatus[] = {"Open house len: "};
+PROGMEM const prog_char strCacheStatus[] = {"Card cache hits: "};
+PROGMEM const prog_char strCacheMisses[] = {", misses: "};
+PROGMEM const prog_char strReaderTimeoutStatus[] = {"Reader timeouts: "};
+PROGMEM const prog_char strReaderDroppedStatus[] = {"Reader frames dropped: "};
+PROGMEM const prog_char strReaderQueuedStatus[] = {", most queued: "};
+PROGMEM const prog_char strReaderRecoveredStatus[] = {"Reader frames recovered: "};
+PROGMEM const prog_char strLogOverflowStatus[] = {"Log queue overflows: "};
+PROGMEM const prog_char strSwipeReadStatus[] = {"Last swipe read: "};
+PROGMEM const prog_char strSwipeDecideStatus[] = {" us, decided after: "};
+PROGMEM const prog_char strSwipeWarmStatus[] = {"Swipe warm-up: "};
+PROGMEM const prog_char strSwipeOverlapStatus[] = {" us, overlapped: "};
+PROGMEM const prog_char strMicros[] = {" us"};
+PROGMEM const prog_char strFreeMemoryStatus[] = {"Free memory: "};
+PROGMEM const prog_char strStackHeadroomStatus[] = {"Stack headroom: "};
+PROGMEM const prog_char strBytes[] = {" bytes"};
 
 // Strings for date/time
 PROGMEM const prog_char strDateTimePrompt[] = {"Enter YY-MM-DD HH:MM:SS? "};
@@ -39,7 +58,7 @@ PROGMEM const prog_char strDeleteCardTitle[] = {"\n**Delete cards**\n\n"};
 PROGMEM const prog_char strSlotPrompt[] = {"Slot number? "};
 PROGMEM const prog_char strEditingCard[] = {"Editing card "};
 PROGMEM const prog_char strDeletingCard[] = {"Deleting card "};
-PROGMEM const prog_char strCardPrompt[] = {"Serial? (FFF-CCCCC) "};
+PROGMEM const prog_char strCardPrompt[] = {"Serial? (FFF-CCCCC or FFFFF-CCCCCCC/BB) "};
 PROGMEM const prog_char strActivePrompt[] = {"Card active? "};
 PROGMEM const prog_char strConfirmPrompt[] = {"Confirm? "};
 PROGMEM const prog_char strSerialExists[] = {"Card exists"};
@@ -50,7 +69,11 @@ PROGMEM const prog_char strDisabled[] = {" - disabled"};
 PROGMEM const prog_char strBlank[] = {" - blank"};
 
 // Strings for log management
+#if FEATURE_LOG_QUERY
+PROGMEM const prog_char strLogMenu[] = {"\n**Log Management**\n\n[1] Review log\n[2] Dump\n[3] Monitor\n[4] Query\n[9] Back to main\n\n> "};
+#else
 PROGMEM const prog_char strLogMenu[] = {"\n**Log Management**\n\n[1] Review log\n[2] Dump\n[3] Monitor\n[9] Back to main\n\n> "};
+#endif
 PROGMEM const prog_char strReviewLogTitle[] = {"\n**Review log**\n"};
 PROGMEM const prog_char strDumpLogTitle[] = {"\n**Dump log**\n"};
 PROGMEM const prog_char strMonitorLogTitle[] = {"\n**Monitoring log**\n\nPress enter to stop\n\n"};
@@ -61,6 +84,14 @@ PROGMEM const prog_char strEnterDay[] = {"Day? (0=all) "};
 PROGMEM const prog_char strLogNotFound[] = {"Log not found: "};
 PROGMEM const prog_char strNoLogEntries[] = {"No entries found"};
 PROGMEM const prog_char strSearchingLog[] = {"Scanning log: "};
+PROGMEM const prog_char strQueryLogTitle[] = {"\n**Query log**\n\nPress enter to stop\n"};
+PROGMEM const prog_char strQueryCardPrompt[] = {"Serial or facility? (blank=any) "};
+PROGMEM const prog_char strQueryTypePrompt[] = {"Type? (card/door/error/admin/mesg, blank=any) "};
+PROGMEM const prog_char strQueryFromPrompt[] = {"From? (YY-MM-DD HH:MM:SS, blank=start of month) "};
+PROGMEM const prog_char strQueryToPrompt[] = {"To? (YY-MM-DD HH:MM:SS, blank=now) "};
+PROGMEM const prog_char strQueryScanned[] = {"Scanned "};
+PROGMEM const prog_char strQueryBytes[] = {" bytes in "};
+PROGMEM const prog_char strQueryMatches[] = {" ms, matches: "};
 PROGMEM const prog_char strPressEnter[] = {"\nEnter to continue, 'q' to stop.\n"};
 
 // Strings for the diagnostics menu
@@ -93,6 +124,13 @@ PROGMEM const prog_char strSDInitFail[] = {"Failed to init SD"};
 PROGMEM const prog_char strConfigPass[] = {"password"};
 PROGMEM const prog_char strConfigOpenDoor[] = {"open-door-len"};
 PROGMEM const prog_char strConfigOpenHouse[] = {"open-house-len"};
+PROGMEM const prog_char strConfigCardFormat[] = {"card-format"};
+PROGMEM const prog_char strConfigBinary[] = {"binary"};
+PROGMEM const prog_char strConfigText[] = {"text"};
+PROGMEM const prog_char strConfigWide[] = {"wide"};
+PROGMEM const prog_char strConfigReaderTimeout[] = {"reader-timeout"};
+PROGMEM const prog_char strConfigLogFormat[] = {"log-format"};
+PROGMEM const prog_char strConfigClockSync[] = {"clock-sync"};
 PROGMEM const prog_char strConfigInvalid[] = {"Invalid config"};
 PROGMEM const prog_char strConfigBadLine[] = {"Invalid config"};
 PROGMEM const prog_char strErrorLoadingConfig[] = {"Error loading config"};
@@ -109,11 +147,15 @@ PROGMEM const prog_char strRecordTooLong[] = {"Record too long"};
 PROGMEM const prog_char strRecordTooShort[] = {"Record too short"};
 PROGMEM const prog_char strDatabaseEOF[] = {"Database EOF"};
 PROGMEM const prog_char strDatabaseDoesNotExist[] = {"Database does not exist"};
+PROGMEM const prog_char strCardTooWide[] = {"Card needs card-format = wide"};
 
 PROGMEM const prog_char strPrematureEnd[] = {"Premature end of data"};
 PROGMEM const prog_char strParityFail[] = {"Parity fail"};
 PROGMEM const prog_char strInvalidBegin[] = {"Invalid start segment"};
 PROGMEM const prog_char strLRCFail[] = {"LRC fail"};
+PROGMEM const prog_char strLRCParityFail[] = {"LRC parity fail"};
+PROGMEM const prog_char strUnknownFormat[] = {"Unknown card format"};
+PROGMEM const prog_char strFormatParityFail[] = {"Card parity fail"};
 PROGMEM const prog_char strTrailingZeros[] = {"Expected trailing 0s: "};
 PROGMEM const prog_char strPaddingFail[] = {"Pad fail"};
 PROGMEM const prog_char strLeadingZeros[] = {"Expected leading 0s: "};
@@ -0,0 +1,116 @@
+/*
+ * haus|prox - Electronic door access control system
+ * Copyright (C) 2011  Peter Rogers (peter.rogers@gmail.com)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* DateTime.cpp */
+
+#include <stdlib.h>
+#include <string.h>
+#include "DateTime.h"
+
+#define SECONDS_PER_DAY   86400UL
+
+PROGMEM static const byte daysInMonth[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+/* Every year the clock can hold (2000-2099) that is divisible by 4 is a leap year */
+static int days_in_month(byte month, byte year)
+{
+  if (month == 2 && (year & 3) == 0) {
+    return 29;
+  }
+  return pgm_read_byte(&daysInMonth[month-1]);
+}
+
+/* Writes a number (0-99) as two digits, followed by 'sep' */
+static char *put_two_digits(char *buf, byte value, char sep)
+{
+  buf[0] = '0' + value / 10;
+  buf[1] = '0' + value % 10;
+  buf[2] = sep;
+  return buf + 3;
+}
+
+void format_date_time(const DateTime &time, char *buf, int buflen)
+{
+  // Make sure the buffer is large enough to fit the data
+  if (buflen >= 20) {
+    /* Written out by hand since this timestamps every log message, and sprintf is slow (and 
+     * pulls in a lot of code) */
+    buf[0] = '2';
+    buf[1] = '0';
+    buf = put_two_digits(buf + 2, time.year % 100, '/');
+    buf = put_two_digits(buf, time.month % 100, '/');
+    buf = put_two_digits(buf, time.day % 100, ' ');
+    buf = put_two_digits(buf, time.hours % 100, ':');
+    buf = put_two_digits(buf, time.minutes % 100, ':');
+    buf = put_two_digits(buf, time.seconds % 100, ' ');
+    *buf = 0;
+  }
+}
+
+int parse_date_time(char *buf, DateTime &time)
+{
+  const char *delims = ":-/ ";
+  byte *fields[] = {&time.year, &time.month, &time.day, &time.hours, &time.minutes, &time.seconds};
+  int count = 0;
+  
+  char *str = strtok(buf, delims);
+  while (str != NULL && count < 6) 
+  {
+    *fields[count++] = atoi(str);
+    str = strtok(NULL, delims);
+  }
+  return count;
+}
+
+unsigned long date_to_epoch(const DateTime &time)
+{
+  /* Count the days in the years before this one (including the leap days), then the months */
+  unsigned long days = 365UL*time.year + (time.year+3)/4;
+  for (byte month = 1; month < time.month && month <= 12; month++) {
+    days += days_in_month(month, time.year);
+  }
+  if (time.day > 0) {
+    days += time.day-1;
+  }
+  return days*SECONDS_PER_DAY + (time.hours*60UL + time.minutes)*60UL + time.seconds;
+}
+
+void epoch_to_date(unsigned long epoch, DateTime &time)
+{
+  unsigned long days = epoch / SECONDS_PER_DAY;
+  unsigned long secs = epoch % SECONDS_PER_DAY;
+  time.hours = secs / 3600;
+  time.minutes = (secs / 60) % 60;
+  time.seconds = secs % 60;
+
+  time.year = 0;
+  while (1)
+  {
+    int len = (time.year & 3) == 0 ? 366 : 365;
+    if (days < (unsigned long)len) break;
+    days -= len;
+    time.year++;
+  }
+  time.month = 1;
+  while (days >= (unsigned long)days_in_month(time.month, time.year)) 
+  {
+    days -= days_in_month(time.month, time.year);
+    time.month++;
+  }
+  time.day = days+1;
+}
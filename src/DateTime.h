@@ -0,0 +1,50 @@
+/*
+ * haus|prox - Electronic door access control system
+ * Copyright (C) 2011  Peter Rogers (peter.rogers@gmail.com)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* DateTime.h */
+
+#ifndef __DATE_TIME_H__
+#define __DATE_TIME_H__
+
+#include "Arduino.h"
+
+/* A date and time as kept by the clock. Note the year ranges 0-99. */
+struct DateTime
+{
+  byte year;
+  byte month;
+  byte day;
+  byte hours;
+  byte minutes;
+  byte seconds;
+};
+
+/* Format a date/time in the buffer as "YYYY/MM/DD hh:mm:ss ". If the buffer is not long enough 
+ * (minimum 20 chars) this function does nothing. */
+void format_date_time(const DateTime &time, char *buf, int len);
+
+/* Parses a date/time like "YY-MM-DD HH:MM:SS" into 'time', returning the number of fields found 
+ * (from the left). The fields that aren't given are left unchanged. Note 'buf' is modified. */
+int parse_date_time(char *buf, DateTime &time);
+
+/* Converts between a date/time and the number of seconds since 2000/01/01 00:00:00 (the 
+ * earliest date the clock can hold). This is how times are stored in the binary log. */
+unsigned long date_to_epoch(const DateTime &time);
+void epoch_to_date(unsigned long epoch, DateTime &time);
+
+#endif
@@ -20,16 +20,19 @@
 
 #include "Arduino.h"
 #include "Door.h"
+#include "Pins.h"
+
+/* The latch output pin (HIGH=unlocked) */
+typedef FastPin<PIN_DOOR_LATCH> LatchPin;
 
 Door::Door()
 {
   lockDoorCountdown = 0;
 }
 
-void Door::begin(int pin)
+void Door::begin()
 {
-  latchPin = pin;
-  pinMode(latchPin, OUTPUT);
+  LatchPin::output();
 }
 
 void Door::lock()
@@ -37,7 +40,7 @@ void Door::lock()
   // Disable interrupts
   cli();
   lockDoorCountdown = 0;
-  digitalWrite(latchPin, LOW);
+  LatchPin::low();
   // Re-enable interrupts
   sei();
 }
@@ -48,7 +51,7 @@ void Door::unlock(long duration)
   cli();
   if (duration > 0) {
     lockDoorCountdown = duration;
-    digitalWrite(latchPin, HIGH);
+    LatchPin::high();
   }
   // Re-enable interrupts
   sei();
@@ -62,7 +65,7 @@ void Door::tick()
     lockDoorCountdown--;
     if (lockDoorCountdown == 0) {
       /* Lock the door again */
-      digitalWrite(latchPin, LOW);
+      LatchPin::low();
     }
   }
 }
@@ -27,13 +27,12 @@ class Door
   private:
     /* The number of seconds left until the door should be locked again */
     long  lockDoorCountdown;
-    /* The latch output pin (HIGH=locked) */
-    int latchPin;
 
   public:
     Door();
 
-    void begin(int pin);
+    /* Sets up the latch output (PIN_DOOR_LATCH) */
+    void begin();
     void lock();
     void unlock(long duration);
     void tick();
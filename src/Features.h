@@ -0,0 +1,40 @@
+/*
+ * haus|prox - Electronic door access control system
+ * Copyright (C) 2011  Peter Rogers (peter.rogers@gmail.com)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FEATURES_H__
+#define __FEATURES_H__
+
+/* Features.h */
+
+/* Optional features. With everything in, the program doesn't fit in the 32K of flash on an 
+ * ATmega328, so these are left out unless they are turned on here (set to 1). Code that isn't
+ * used is dropped when the program is linked. */
+
+/* Writing log files as packed binary records (see LogRecord.h), picked with "log-format=binary" 
+ * in the config file. Without it the setting is ignored and the logs are always text. */
+#ifndef FEATURE_BINARY_LOG
+#define FEATURE_BINARY_LOG      0
+#endif
+
+/* The query command on the log menu, which searches the logs by card, type and time range (see 
+ * LogQuery.h) */
+#ifndef FEATURE_LOG_QUERY
+#define FEATURE_LOG_QUERY       0
+#endif
+
+#endif
@@ -0,0 +1,280 @@
+/*
+ * haus|prox - Electronic door access control system
+ * Copyright (C) 2011  Peter Rogers (peter.rogers@gmail.com)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* LogQuery.cpp */
+
+#include "LogQuery.h"
+#include "Logger.h"
+#include "Const.h"
+#include "utils.h"
+
+/* Text log lines start with the timestamp (19 chars) and the message type tag (7 chars) */
+#define LINE_TIME_LEN       19
+#define LINE_TYPE_POS       20
+#define LINE_TYPE_LEN       7
+#define LINE_MIN_LEN        (LINE_TYPE_POS + LINE_TYPE_LEN)
+
+LogQuery::LogQuery()
+{
+  key = 0;
+  filterKey = false;
+  facility = 0;
+  filterFacility = false;
+  level = 0;
+  memset(&from, 0, sizeof(from));
+  memset(&to, 0, sizeof(to));
+  bytesScanned = 0;
+  matches = 0;
+  elapsed = 0;
+  aborted = false;
+}
+
+void LogQuery::run(Stream &stream)
+{
+  unsigned long started = millis();
+  bytesScanned = 0;
+  matches = 0;
+  stopped = false;
+  aborted = false;
+
+  fromEpoch = date_to_epoch(from);
+  toEpoch = date_to_epoch(to);
+  format_date_time(from, fromStr, sizeof(fromStr));
+  format_date_time(to, toStr, sizeof(toStr));
+
+  int year = from.year;
+  int month = from.month;
+  while (!stopped && (year < to.year || (year == to.year && month <= to.month)))
+  {
+    char name[13];
+    logger.formatFileName(name, year, month);
+    File file = SD.open(name, FILE_READ);
+    if (file) 
+    {
+      /* Skip the days before the start of the range if the log index knows where they end */
+      unsigned long start = 0, end;
+      if (year == from.year && month == from.month && 
+          logger.findDay(year, month, from.day, start, end) != LOG_DAY_FOUND) {
+        start = 0;
+      }
+#if FEATURE_BINARY_LOG
+      if (logger.format == LOG_FORMAT_BINARY) {
+        scanBinary(file, start, stream);
+      } else
+#endif
+      {
+        scanText(file, start, stream);
+      }
+      file.close();
+    }
+    if (++month > 12) {
+      month = 1;
+      year++;
+    }
+  }
+  elapsed = millis() - started;
+}
+
+void LogQuery::checkAbort()
+{
+  if (Serial.available() > 0) {
+    /* Consume the input so it doesn't get picked up elsewhere */
+    while(Serial.available() > 0) Serial.read();
+    stopped = true;
+    aborted = true;
+  }
+}
+
+boolean LogQuery::matchKey(boolean hasKey, cardkey_t cardKey)
+{
+  if (!filterKey && !filterFacility) {
+    return true;
+  }
+  if (!hasKey) {
+    return false;
+  }
+  if (filterKey && cardKey != key) {
+    return false;
+  }
+  return !filterFacility || KEY_FACILITY(cardKey) == facility;
+}
+
+boolean LogQuery::matchLine(char *line, int len)
+{
+  /* Skip blank lines and anything else without a timestamp and type */
+  if (len < LINE_MIN_LEN || line[4] != '/' || line[LINE_TIME_LEN] != ' ') {
+    return false;
+  }
+  /* The timestamps are fixed width, so they compare as strings */
+  if (strncmp(line, fromStr, LINE_TIME_LEN) < 0) {
+    return false;
+  }
+  if (strncmp(line, toStr, LINE_TIME_LEN) > 0) {
+    /* The log is in time order, so nothing after this matches either */
+    stopped = true;
+    return false;
+  }
+  if (level != 0 && strncmp_P(line + LINE_TYPE_POS, log_type_str(level), LINE_TYPE_LEN) != 0) {
+    return false;
+  }
+  cardkey_t cardKey = 0;
+  boolean hasKey = false;
+  if (filterKey || filterFacility) {
+    char *serial = strstr_P(line + LINE_MIN_LEN, strSerialPart);
+    hasKey = (serial != NULL && parse_serial(serial + strlen_P(strSerialPart), cardKey));
+  }
+  return matchKey(hasKey, cardKey);
+}
+
+#if FEATURE_BINARY_LOG
+boolean LogQuery::matchRecord(const LogRecord &rec)
+{
+  if (rec.time < fromEpoch) {
+    return false;
+  }
+  if (rec.time > toEpoch) {
+    stopped = true;
+    return false;
+  }
+  if (level != 0 && rec.level != level) {
+    return false;
+  }
+  return matchKey(rec.flags & LOG_RECORD_KEY, rec.key);
+}
+#endif
+
+void LogQuery::scanText(File &file, unsigned long start, Stream &stream)
+{
+  if (start > 0 && !file.seek(start)) {
+    return;
+  }
+  /* Read a chunk at a time, and carry any partial line at the end over to the next read */
+  char buf[LOG_QUERY_CHUNK+1];
+  int len = 0;
+  /* Whether we are partway through a line longer than the buffer, and whether it matched */
+  boolean partial = false;
+  boolean printing = false;
+  while (!stopped)
+  {
+    int n = file.read(buf + len, LOG_QUERY_CHUNK - len);
+    if (n <= 0) {
+      break;
+    }
+    bytesScanned += n;
+    len += n;
+
+    char *line = buf;
+    char *end = buf + len;
+    while (!stopped)
+    {
+      char *newline = (char*)memchr(line, '\n', end - line);
+      if (newline == NULL) {
+        if (line == buf && len == LOG_QUERY_CHUNK) {
+          /* The line is longer than the buffer. Match it on the start, and pass the rest through. */
+          *end = 0;
+          if (!partial) {
+            partial = true;
+            printing = matchLine(buf, len);
+            if (printing) matches++;
+          }
+          if (printing) stream.print(buf);
+          line = end;
+        }
+        break;
+      }
+      *newline = 0;
+      if (newline > line && newline[-1] == '\r') {
+        // Lines with a card buffer end with CRLF
+        newline[-1] = 0;
+      }
+      if (partial) {
+        /* The end of a long line */
+        if (printing) stream.println(line);
+        partial = false;
+      } else if (matchLine(line, strlen(line))) {
+        matches++;
+        stream.println(line);
+      }
+      line = newline + 1;
+    }
+    len = end - line;
+    memmove(buf, line, len);
+    checkAbort();
+  }
+  if (!stopped && (len > 0 || partial)) {
+    /* The last line of the log doesn't have a newline */
+    buf[len] = 0;
+    if (partial) {
+      if (printing) stream.println(buf);
+    } else if (matchLine(buf, len)) {
+      matches++;
+      stream.println(buf);
+    }
+  }
+}
+
+#if FEATURE_BINARY_LOG
+void LogQuery::scanBinary(File &file, unsigned long start, Stream &stream)
+{
+  /* Records are read one at a time, as the SD library buffers the sector they are in anyway */
+  byte rec[LOG_RECORD_LEN];
+  if (file.read(rec, LOG_RECORD_LEN) != LOG_RECORD_LEN || !check_log_header(rec)) {
+    return;
+  }
+  if (start > LOG_RECORD_LEN && !file.seek(start)) {
+    return;
+  }
+  bytesScanned += LOG_RECORD_LEN;
+
+  /* The card frame records still to come after the last message, and whether to print them */
+  int frameBits = 0;
+  int frameDone = 0;
+  boolean printFrame = false;
+  while (!stopped && file.read(rec, LOG_RECORD_LEN) == LOG_RECORD_LEN)
+  {
+    bytesScanned += LOG_RECORD_LEN;
+    if (frameDone < frameBits)
+    {
+      /* Part of the card frame stored after a message */
+      for (int bit = 0; bit < 8*LOG_RECORD_LEN && frameDone < frameBits; bit++, frameDone++) {
+        if (printFrame) stream.print((rec[bit >> 3] >> (bit & 7)) & 1);
+      }
+      if (frameDone == frameBits && printFrame) {
+        stream.println();
+      }
+      continue;
+    }
+
+    LogRecord record;
+    unpack_log_record(rec, record);
+    frameBits = record.frameBits;
+    frameDone = 0;
+    printFrame = matchRecord(record);
+    if (printFrame) {
+      LogEvent event;
+      Logger::decodeRecord(record, event);
+      matches++;
+      logger.printEvent(stream, event, NULL);
+      if (frameBits == 0) {
+        stream.println();
+      }
+    }
+    checkAbort();
+  }
+}
+#endif
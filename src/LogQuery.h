@@ -0,0 +1,96 @@
+/*
+ * haus|prox - Electronic door access control system
+ * Copyright (C) 2011  Peter Rogers (peter.rogers@gmail.com)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* LogQuery.h */
+
+#ifndef __LOG_QUERY_H__
+#define __LOG_QUERY_H__
+
+#include "Arduino.h"
+#include <SD.h>
+#include "CardKey.h"
+#include "DateTime.h"
+#include "Features.h"
+#include "LogRecord.h"
+
+/* Text log files are scanned this many bytes at a time. The buffer is on the stack, so it is kept 
+ * small (the SD library already caches the whole sector). It holds the timestamp, type, message 
+ * and serial number of any log line, so longer lines (with a card frame) are matched on that. */
+#define LOG_QUERY_CHUNK     96
+
+/* Searches the log files for the messages matching a set of filters, which may span several
+ * monthly log files. Fill in the filters then call 'run'. */
+class LogQuery
+{
+  private:
+    /* The time range as seconds since 2000, and as the text the log lines start with */
+    unsigned long fromEpoch;
+    unsigned long toEpoch;
+    char fromStr[21];
+    char toStr[21];
+
+    /* Whether the scan has finished early (the user stopped it, or the end time has passed) */
+    boolean stopped;
+
+    /* Scans a text or binary log file from the offset 'start', printing matches to 'stream' */
+    void scanText(File &file, unsigned long start, Stream &stream);
+#if FEATURE_BINARY_LOG
+    void scanBinary(File &file, unsigned long start, Stream &stream);
+#endif
+
+    /* Checks a line from a text log (without the newline) against the filters */
+    boolean matchLine(char *line, int len);
+#if FEATURE_BINARY_LOG
+    /* Checks a message from a binary log against the filters */
+    boolean matchRecord(const LogRecord &rec);
+#endif
+    /* Checks the card key of a message (if it has one) against the filters */
+    boolean matchKey(boolean hasKey, cardkey_t key);
+
+    /* Stops the scan if the user has pressed a key */
+    void checkAbort();
+
+  public:
+    /* Only messages about this card (if 'filterKey' is set), or from cards with this 
+     * facility code (if 'filterFacility' is set) */
+    cardkey_t key;
+    boolean filterKey;
+    unsigned int facility;
+    boolean filterFacility;
+
+    /* Only messages of this type (one of LOG_*), or 0 for any type */
+    byte level;
+
+    /* Only messages logged within this time range (inclusive) */
+    DateTime from;
+    DateTime to;
+
+    /* Results of the last run: the bytes read from the log files, the matching messages, how 
+     * long the scan took (ms) and whether it was aborted by the user */
+    unsigned long bytesScanned;
+    unsigned long matches;
+    unsigned long elapsed;
+    boolean aborted;
+
+    LogQuery();
+
+    /* Scans the log files for each month in the time range, printing the matching messages */
+    void run(Stream &stream);
+};
+
+#endif
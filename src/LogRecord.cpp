@@ -0,0 +1,169 @@
+/*
+ * haus|prox - Electronic door access control system
+ * Copyright (C) 2011  Peter Rogers (peter.rogers@gmail.com)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* LogRecord.cpp */
+
+#include "LogRecord.h"
+#include "Const.h"
+
+/* Every message that can be logged, indexed by the id it is stored under in the binary log. 
+ * Only ever add messages to the end, so older log files still decode. */
+PROGMEM const prog_char * const logMessages[] = {
+  strBootupMessage,
+  strAdmitEntry,
+  strValidOpenHouse,
+  strDenyUnregCard,
+  strDenyDisabledCard,
+  strDoorLocked,
+  strDoorUnlocked,
+  strDoorAlreadyUnlocked,
+  strOpenHouseOn,
+  strOpenHouseOff,
+  strOpenHouseExpired,
+  strLoginMessage,
+  strLoginDeniedLog,
+  strDateTimeOkay,
+  strInsertedCard,
+  strDeletedCard,
+  strUpdatedCard,
+  strSDInitFail,
+  strErrorLoadingConfig,
+  strConfigInvalid,
+  strConfigBadLine,
+  // Card database errors
+  strSuccess,
+  strDatabaseOpenFail,
+  strRecordTooShort,
+  strRecordTooLong,
+  strInvalidRecord,
+  strDatabaseNotFound,
+  strDatabaseEOF,
+  strDatabaseDoesNotExist,
+  strSerialExists,
+  strDatabaseFailure,
+  // Card reader errors
+  strPrematureEnd,
+  strParityFail,
+  strInvalidBegin,
+  strLRCFail,
+  strLRCParityFail,
+  strTrailingZeros,
+  strPaddingFail,
+  strLeadingZeros,
+  strUnknownFormat,
+  strFormatParityFail,
+  strUnknown,
+  strCardTooWide,
+};
+
+#define NUM_LOG_MESSAGES    (sizeof(logMessages)/sizeof(logMessages[0]))
+
+static void put_bytes(byte *buf, unsigned long long value, int len)
+{
+  for (int n = 0; n < len; n++) {
+    buf[n] = (byte)(value >> (8*n));
+  }
+}
+
+static unsigned long long get_bytes(const byte *buf, int len)
+{
+  unsigned long long value = 0;
+  for (int n = len-1; n >= 0; n--) {
+    value = (value << 8) | buf[n];
+  }
+  return value;
+}
+
+void pack_log_record(const LogRecord &rec, byte *buf)
+{
+  put_bytes(buf, rec.time, 4);
+  buf[4] = rec.level;
+  buf[5] = rec.msg;
+  buf[6] = rec.flags;
+  buf[7] = rec.frameBits;
+  put_bytes(buf+8, rec.key, 8);
+}
+
+void unpack_log_record(const byte *buf, LogRecord &rec)
+{
+  rec.time = (unsigned long)get_bytes(buf, 4);
+  rec.level = buf[4];
+  rec.msg = buf[5];
+  rec.flags = buf[6];
+  rec.frameBits = buf[7];
+  rec.key = get_bytes(buf+8, 8);
+}
+
+void pack_log_header(byte *buf)
+{
+  memset(buf, 0, LOG_RECORD_LEN);
+  memcpy(buf, LOG_FILE_MAGIC, sizeof(LOG_FILE_MAGIC)-1);
+  buf[sizeof(LOG_FILE_MAGIC)-1] = LOG_FILE_VERSION;
+}
+
+boolean check_log_header(const byte *buf)
+{
+  return (memcmp(buf, LOG_FILE_MAGIC, sizeof(LOG_FILE_MAGIC)-1) == 0 && 
+          buf[sizeof(LOG_FILE_MAGIC)-1] == LOG_FILE_VERSION);
+}
+
+const prog_char *log_type_str(int level)
+{
+  switch(level) {
+    case LOG_CARD:
+      return strCardType;
+    case LOG_ADMIN:
+      return strAdminType;
+    case LOG_ERROR:
+      return strErrorType;
+    case LOG_DOOR:
+      return strDoorType;
+  }
+  return strMessageType;
+}
+
+/* Compares two strings held in program memory */
+static boolean prog_str_same(const prog_char *a, const prog_char *b)
+{
+  while (1)
+  {
+    char ch = pgm_read_byte(a++);
+    if (ch != (char)pgm_read_byte(b++)) return false;
+    if (ch == 0) return true;
+  }
+}
+
+byte log_message_id(const prog_char *msg)
+{
+  /* Every file that includes Const.h gets its own copy of the strings, so they are compared 
+   * by contents rather than by address */
+  for (byte id = 0; id < NUM_LOG_MESSAGES; id++) {
+    if (prog_str_same(log_message_str(id), msg)) {
+      return id;
+    }
+  }
+  return LOG_MESSAGE_UNKNOWN;
+}
+
+const prog_char *log_message_str(byte id)
+{
+  if (id >= NUM_LOG_MESSAGES) {
+    return NULL;
+  }
+  return (const prog_char*)pgm_read_word(&logMessages[id]);
+}
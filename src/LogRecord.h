@@ -0,0 +1,87 @@
+/*
+ * haus|prox - Electronic door access control system
+ * Copyright (C) 2011  Peter Rogers (peter.rogers@gmail.com)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* LogRecord.h */
+
+#ifndef __LOG_RECORD_H__
+#define __LOG_RECORD_H__
+
+#include "Arduino.h"
+#include "CardKey.h"
+
+/* The types of log message */
+#define LOG_CARD     1
+#define LOG_ERROR    2
+#define LOG_ADMIN    3  
+#define LOG_MESG     4
+#define LOG_DOOR     5
+
+/* The binary log is a series of fixed-length records. Each message takes one record, stored
+ * little-endian as:
+ *
+ *   0-3   time (seconds since 2000/01/01 00:00:00, see date_to_epoch)
+ *   4     message type (LOG_CARD, LOG_ERROR, ...)
+ *   5     message id (see log_message_id)
+ *   6     flags (LOG_RECORD_KEY if the message is about a card)
+ *   7     the number of bits in the card frame stored after the record (0 = none)
+ *   8-15  card key
+ *
+ * A card frame is packed into the records that follow (see LOG_FRAME_RECORDS), one bit per
+ * bit with the first bit in the lowest bit of the first byte. The file starts with a header 
+ * record holding LOG_FILE_MAGIC and LOG_FILE_VERSION. See 'utils/logdecode.cpp'. */
+#define LOG_RECORD_LEN         16
+#define LOG_FILE_MAGIC         "HPLOG"
+#define LOG_FILE_VERSION       1
+
+#define LOG_RECORD_KEY         0x01
+
+/* The id stored for a message that isn't in the table of log messages */
+#define LOG_MESSAGE_UNKNOWN    0xFF
+
+/* The number of records holding a card frame of 'bits' bits */
+#define LOG_FRAME_RECORDS(bits)  (((bits) + 8*LOG_RECORD_LEN-1) / (8*LOG_RECORD_LEN))
+
+/* A message from the binary log */
+struct LogRecord
+{
+  unsigned long time;
+  byte level;
+  byte msg;
+  byte flags;
+  byte frameBits;
+  cardkey_t key;
+};
+
+/* Packs a record into LOG_RECORD_LEN bytes, or unpacks it again */
+void pack_log_record(const LogRecord &rec, byte *buf);
+void unpack_log_record(const byte *buf, LogRecord &rec);
+
+/* Fills in the header record that starts a binary log file, or checks it */
+void pack_log_header(byte *buf);
+boolean check_log_header(const byte *buf);
+
+/* Returns the tag a type of message is printed with, eg "[CARD] " */
+const prog_char *log_type_str(int level);
+
+/* Returns the id a log message is stored as, or LOG_MESSAGE_UNKNOWN */
+byte log_message_id(const prog_char *msg);
+
+/* Returns the log message with the given id, or NULL */
+const prog_char *log_message_str(byte id);
+
+#endif
@@ -32,103 +32,342 @@ Logger::Logger()
 {
   sdEnabled = false;
   serialLogging = true;
+  logMonth = 0;
+  logYear = 0;
+  logDay = 0;
+  queueHead = 0;
+  queueCount = 0;
+  overflows = 0;
+  queuedMax = 0;
+  format = LOG_FORMAT_TEXT;
 }
 
-void Logger::logMessage(int level, const prog_char *msg)
+boolean Logger::openLogFile(char *buf, const DateTime &time)
 {
-  logMessage(level, msg, NULL, NULL);
+  if (logFile && time.month == logMonth && time.year == logYear) {
+    return true;
+  }
+  // Either this is the first message, or the month has rolled over
+  close();
+  formatFileName(buf, time.year, time.month);
+  logFile = SD.open(buf, FILE_WRITE);
+  logMonth = time.month;
+  logYear = time.year;
+  logDay = 0;
+#if FEATURE_BINARY_LOG
+  if (logFile && format == LOG_FORMAT_BINARY && logFile.size() == 0) {
+    /* Start a new binary log with the header */
+    byte header[LOG_RECORD_LEN];
+    pack_log_header(header);
+    if (logFile.write(header, LOG_RECORD_LEN) != LOG_RECORD_LEN) {
+      close();
+    }
+  }
+#endif
+  return logFile;
 }
 
-void Logger::logMessage(int level, const prog_char *msg, const char *serial, CardReader *reader)
-{
-  /* Get the current time from our chip */
-  clock.update();
+/* The log file extensions, by format (the file itself, then its index). They are kept in flash, 
+ * as sprintf formats for the file names would take SRAM. */
+PROGMEM const prog_char logFileExt[][4] = {"log", "idx", "bin", "bdx"};
 
-  /* We need a buffer to hold the file name (8+1+3=12 chars+null) and later the 
-   * timestamp string (20 chars+null) */
-  char buf[22];
+/* Formats the name of a log file as hp-YY-MM.ext */
+static void format_log_name(char *buf, int year, int month, const prog_char *ext)
+{
   /* Extract the last two digits of the year */
-  int year2d = clock.year - 100*(clock.year/100);
-  sprintf(buf, "hp-%02d-%02d.log", year2d, clock.month);
+  int year2d = year - 100*(year/100);
+  buf[0] = 'h';
+  buf[1] = 'p';
+  buf[2] = '-';
+  buf[3] = '0' + year2d/10;
+  buf[4] = '0' + year2d%10;
+  buf[5] = '-';
+  buf[6] = '0' + month/10;
+  buf[7] = '0' + month%10;
+  buf[8] = '.';
+  strcpy_P(buf+9, ext);
+}
+
+void Logger::formatFileName(char *buf, int year, int month)
+{
+  format_log_name(buf, year, month, logFileExt[(format == LOG_FORMAT_BINARY) ? 2 : 0]);
+}
+
+void Logger::formatIndexName(char *buf, int year, int month)
+{
+  format_log_name(buf, year, month, logFileExt[(format == LOG_FORMAT_BINARY) ? 3 : 1]);
+}
 
-  /* Log to a file if the SD card is enabled */
-  File file;
+unsigned long Logger::firstOffset()
+{
+  /* Binary logs start with a header record */
+  return (format == LOG_FORMAT_BINARY) ? LOG_RECORD_LEN : 0;
+}
 
-  if (sdEnabled) {
-    file = SD.open(buf, FILE_WRITE);
+void Logger::indexDay(byte day)
+{
+  logDay = day;
+  if (day < 1 || day >= LOG_INDEX_LEN) {
+    return;
   }
-  
-//  if (!file) {
-//    print_prog_str(&Serial, strLogOpenFail);
-//  }
-  
-  // Write out the timestamp
-  clock.formatDateTime(buf, sizeof(buf));
-  if (serialLogging) {
-    Serial.print(buf);
+  char buf[13];
+  formatIndexName(buf, logYear, logMonth);
+  File index = SD.open(buf, FILE_WRITE);
+  if (!index) {
+    return;
   }
-  if (file) {
-    file.print(buf);
+  unsigned long offset = logFile.size();
+  if (index.size() == 0) {
+    /* A new index. If the log already has messages in it, they aren't indexed. */
+    for (int n = 0; n < LOG_INDEX_LEN; n++) {
+      unsigned long value = (n == 0) ? offset : LOG_INDEX_UNSET;
+      index.write((const uint8_t*)&value, sizeof(value));
+    }
+  }
+  unsigned long start = 0;
+  if (index.seek(day*sizeof(start)) && index.read(&start, sizeof(start)) == sizeof(start) &&
+      start == LOG_INDEX_UNSET) 
+  {
+    index.seek(day*sizeof(start));
+    index.write((const uint8_t*)&offset, sizeof(offset));
   }
+  index.close();
+}
 
-  // Write out the message type
-  const prog_char *strType=NULL;
-  switch(level) {
-    case LOG_CARD:
-      strType = strCardType;
-      break;
-    case LOG_ADMIN:
-      strType = strAdminType;
-      break;
-    case LOG_ERROR:
-      strType = strErrorType;
-      break;
-    case LOG_DOOR:
-      strType = strDoorType;
-      break;
-    default:
-      strType = strMessageType;
-      break;
+int Logger::findDay(int year, int month, int day, unsigned long &start, unsigned long &end)
+{
+  if (day < 1 || day >= LOG_INDEX_LEN) {
+    return LOG_DAY_UNKNOWN;
   }
-  if (serialLogging) {
-    print_prog_str(strType);
-    print_prog_str(msg);
+  char buf[13];
+  formatIndexName(buf, year, month);
+  File index = SD.open(buf, FILE_READ);
+  if (!index) {
+    return LOG_DAY_UNKNOWN;
+  }
+  /* The offsets are read one at a time, as the SD library buffers the block they are in anyway.
+   * (The whole index would take 128 bytes of stack.) */
+  unsigned long first, offset;
+  boolean ok = (index.read(&first, sizeof(first)) == sizeof(first) && 
+                index.seek(day*sizeof(offset)) && 
+                index.read(&start, sizeof(start)) == sizeof(start));
+  if (ok) {
+    /* The next day to start after this one ends it */
+    end = LOG_INDEX_UNSET;
+    index.seek(sizeof(offset));
+    for (int n = 1; n < LOG_INDEX_LEN; n++) {
+      if (index.read(&offset, sizeof(offset)) != sizeof(offset)) {
+        ok = false;
+        break;
+      }
+      if (offset > start && offset < end) {
+        end = offset;
+      }
+    }
+  }
+  index.close();
+  if (!ok) {
+    return LOG_DAY_UNKNOWN;
   }
 
-  if (file) {
-    print_prog_str(&file, strType);
-    print_prog_str(&file, msg);
+  /* Messages logged before the index was started could be from any day */
+  boolean complete = (first <= firstOffset());
+  if (start == LOG_INDEX_UNSET) {
+    return complete ? LOG_DAY_EMPTY : LOG_DAY_UNKNOWN;
   }
+  if (!complete && start == first) {
+    /* The day started before the index did */
+    return LOG_DAY_UNKNOWN;
+  }
+  return LOG_DAY_FOUND;
+}
 
-  if (serial != NULL) {
-    if (serialLogging) {
-      print_prog_str(strSerialPart);
-      Serial.print(serial);
-    }
-    
-    if (file) {
-      print_prog_str(&file, strSerialPart);
-      file.print(serial);
-    }
+void Logger::close()
+{
+  if (logFile) {
+    logFile.close();
   }
+}
+
+void Logger::logMessage(int level, const prog_char *msg)
+{
+  logMessage(level, msg, NULL, NULL);
+}
+
+void Logger::logMessage(int level, const prog_char *msg, cardkey_t key)
+{
+  LogEvent event;
+  event.hasKey = true;
+  event.key = key;
+  logEvent(level, msg, event, NULL);
+}
+
+void Logger::logMessage(int level, const prog_char *msg, const char *serial, CardReader *reader)
+{
+  LogEvent event;
+  event.hasKey = (serial != NULL && parse_serial(serial, event.key) != 0);
+  logEvent(level, msg, event, reader);
+}
+
+void Logger::logEvent(int level, const prog_char *msg, LogEvent &event, CardReader *reader)
+{
+  event.level = level;
+  event.msg = msg;
+  /* The software clock, so this doesn't touch the I2C bus */
+  event.time = clock.now();
 
   if (reader != NULL) {
-    if (serialLogging) {
-      // Print the card buffer contents to the serial port
-      reader->printBuffer(Serial);
-    }
-    if (file) {
-      // Print the card buffer to the log file
-      reader->printBuffer(file);
-    }
+    /* The card frame is about to be taken off the reader's queue, so write this message out 
+     * now (after the ones already waiting, to keep them in order) */
+    flush();
+    writeEvent(event, reader);
+    logFile.flush();
+    return;
+  }
+
+  if (queueCount == LOG_QUEUE_LEN) {
+    /* The queue is full, so make room by writing out the oldest message now */
+    overflows++;
+    writeEvent(queue[queueHead], NULL);
+    logFile.flush();
+    queueHead = (queueHead + 1) % LOG_QUEUE_LEN;
+    queueCount--;
+  }
+  queue[(queueHead + queueCount) % LOG_QUEUE_LEN] = event;
+  queueCount++;
+  if (queueCount > queuedMax) {
+    queuedMax = queueCount;
+  }
+}
+
+void Logger::flush()
+{
+  if (queueCount == 0) {
+    return;
   }
+  while (queueCount > 0)
+  {
+    writeEvent(queue[queueHead], NULL);
+    queueHead = (queueHead + 1) % LOG_QUEUE_LEN;
+    queueCount--;
+  }
+  /* Flush the messages out to the card together */
+  logFile.flush();
+}
+
+void Logger::writeEvent(LogEvent &event, CardReader *reader)
+{
+  /* We need a buffer to hold the file name (8+1+3=12 chars+null) */
+  char buf[13];
 
   if (serialLogging) {
+    printEvent(Serial, event, reader);
     Serial.println();
   }
-  if (file) {
-    file.print('\n');
-    file.close();
+
+  /* Log to a file if the SD card is enabled. The file is kept open, so this only touches the 
+   * SD card directory when the month changes. */
+  DateTime time;
+  epoch_to_date(event.time, time);
+  if (!sdEnabled || !openLogFile(buf, time)) {
+//    print_prog_str(&Serial, strLogOpenFail);
+    return;
+  }
+  if (time.day != logDay) {
+    indexDay(time.day);
+  }
+
+  boolean ok;
+#if FEATURE_BINARY_LOG
+  if (format == LOG_FORMAT_BINARY) {
+    ok = writeRecord(event, reader);
+  } else
+#endif
+  {
+    printEvent(logFile, event, reader);
+    ok = (logFile.print('\n') == 1);
+  }
+  /* The caller flushes the messages out to the card. If writing fails, the file is reopened for
+   * the next message in case the card was removed. */
+  if (!ok) {
+    close();
   }
 }
 
+void Logger::printEvent(Stream &stream, LogEvent &event, CardReader *reader)
+{
+  // Write out the timestamp (20 chars+null)
+  char buf[22];
+  DateTime time;
+  epoch_to_date(event.time, time);
+  format_date_time(time, buf, sizeof(buf));
+  stream.print(buf);
+
+  // Write out the message type
+  print_prog_str(&stream, log_type_str(event.level));
+  print_prog_str(&stream, event.msg);
+
+  if (event.hasKey) {
+    char serial[SERIAL_LEN+1];
+    format_serial(event.key, serial);
+    print_prog_str(&stream, strSerialPart);
+    stream.print(serial);
+  }
+
+  if (reader != NULL) {
+    // Print the bits of the card frame
+    reader->printBuffer(stream);
+  }
+}
+
+#if FEATURE_BINARY_LOG
+void Logger::decodeRecord(const LogRecord &rec, LogEvent &event)
+{
+  event.time = rec.time;
+  event.level = rec.level;
+  event.msg = log_message_str(rec.msg);
+  if (event.msg == NULL) {
+    event.msg = strUnknown;
+  }
+  event.hasKey = ((rec.flags & LOG_RECORD_KEY) != 0);
+  event.key = rec.key;
+}
+
+boolean Logger::writeRecord(LogEvent &event, CardReader *reader)
+{
+  byte buf[LOG_RECORD_LEN];
+  LogRecord rec;
+  rec.time = event.time;
+  rec.level = event.level;
+  rec.msg = log_message_id(event.msg);
+  rec.flags = 0;
+  rec.key = 0;
+  if (event.hasKey) {
+    rec.key = event.key;
+    rec.flags |= LOG_RECORD_KEY;
+  }
+  rec.frameBits = 0;
+  if (reader != NULL) {
+    rec.frameBits = reader->getFrameBits();
+  }
+  pack_log_record(rec, buf);
+  if (logFile.write(buf, LOG_RECORD_LEN) != LOG_RECORD_LEN) {
+    return false;
+  }
+
+  /* Pack the card frame into the records after this one */
+  for (int start = 0; start < rec.frameBits; start += 8*LOG_RECORD_LEN)
+  {
+    memset(buf, 0, LOG_RECORD_LEN);
+    for (int n = start; n < rec.frameBits && n < start + 8*LOG_RECORD_LEN; n++) {
+      if (reader->getFrameData(n) == 1) {
+        buf[(n-start) >> 3] |= (1 << (n & 7));
+      }
+    }
+    if (logFile.write(buf, LOG_RECORD_LEN) != LOG_RECORD_LEN) {
+      return false;
+    }
+  }
+  return true;
+}
+#endif
@@ -22,23 +22,97 @@
 #define __LOGGER_H__
 
 #include <SD.h>
+#include "CardKey.h"
+#include "Clock.h"
+#include "Features.h"
+#include "LogRecord.h"
 
-#define LOG_CARD     1
-#define LOG_ERROR    2
-#define LOG_ADMIN    3  
-#define LOG_MESG     4
-#define LOG_DOOR     5
+/* The formats log files can be written in. Binary logs hold fixed-length records (see 
+ * LogRecord.h) and are turned back into text by 'utils/logdecode.cpp'. They are only written if
+ * FEATURE_BINARY_LOG is on (see Features.h). */
+#define LOG_FORMAT_TEXT      0
+#define LOG_FORMAT_BINARY    1
+
+/* Each monthly log file has an index (see 'indexDay') of where each day's messages start. It
+ * holds LOG_INDEX_LEN offsets: the first is where indexing started, and the rest are the start
+ * of days 1-31, or LOG_INDEX_UNSET if there are no messages for that day. */
+#define LOG_INDEX_LEN          32
+#define LOG_INDEX_UNSET        0xFFFFFFFFUL
+
+/* Results from 'findDay' */
+#define LOG_DAY_FOUND          0
+#define LOG_DAY_EMPTY          1
+#define LOG_DAY_UNKNOWN        2
+
+/* The number of messages that can wait in RAM to be written out (see 'flush'). Each one takes 16
+ * bytes of SRAM. */
+#define LOG_QUEUE_LEN          4
+/* Waiting messages are written out once there are this many, even if a card is being read */
+#define LOG_QUEUE_HIGH_WATER   3
 
 class CardReader;
 
+/* A log message waiting to be written out, and the time it was logged */
+struct LogEvent
+{
+  byte level;
+  const prog_char *msg;
+  /* The card, if the message is about one. The serial number is only formatted when the message
+   * is written out, as the key takes half the SRAM. */
+  boolean hasKey;
+  cardkey_t key;
+  /* Seconds since 2000 (see 'date_to_epoch') */
+  unsigned long time;
+};
+
+/* Logs messages to the SD card and serial port. Messages are copied into a queue in RAM and
+ * written out later by 'flush', so logging doesn't hold up things like unlocking the door. */
 class Logger
 {
   private:
+    /* Messages waiting to be written out, oldest first */
+    LogEvent queue[LOG_QUEUE_LEN];
+    byte queueHead;
+    byte queueCount;
+
+    /* Writes a message out to the log file and serial port. If 'reader' is given the bits of
+     * its oldest card frame are written as well. */
+    void writeEvent(LogEvent &event, CardReader *reader);
+
+    /* Timestamps a message about the card in 'event' (if any) and queues it, or writes it out now
+     * if 'reader' is given (see 'logMessage') */
+    void logEvent(int level, const prog_char *msg, LogEvent &event, CardReader *reader);
+
+#if FEATURE_BINARY_LOG
+    /* Writes a message to the log file as a binary record (see LogRecord.h) */
+    boolean writeRecord(LogEvent &event, CardReader *reader);
+#endif
+
+    /* The log file for the current month, kept open between messages */
+    File logFile;
+    /* The month (and year) the log file was opened for */
+    int logMonth;
+    int logYear;
+    /* The day of the last message written to the log file */
+    byte logDay;
+
+    /* Records in the index where the messages for 'day' start in the log file (unless they
+     * have already started). This is called before writing the first message of each day. */
+    void indexDay(byte day);
+
+    /* The offset of the first message in a log file */
+    unsigned long firstOffset();
+
+    /* Makes sure the log file for the month of 'time' is open, rotating to a new file when the 
+     * month changes. The file name is formatted into 'buf'. */
+    boolean openLogFile(char *buf, const DateTime &time);
 
   public:
     Logger();
 
     boolean sdEnabled;
+    /* The format log files are written in (one of LOG_FORMAT_*). Set this before logging. */
+    byte format;
     // Whether to log to the serial port as well
     boolean serialLogging;
 
@@ -54,6 +128,43 @@ class Logger
      */
     void logMessage(int level, const prog_char *msg, const char *serial, CardReader *reader=NULL);
 
+    /* As above, but formats the serial number from a card key */
+    void logMessage(int level, const prog_char *msg, cardkey_t key);
+
+    /* Prints a message as a line of text (without the line ending). If 'reader' is given the 
+     * bits of its oldest card frame are printed as well. */
+    void printEvent(Stream &stream, LogEvent &event, CardReader *reader);
+
+    /* Fills in a message from a binary log record */
+#if FEATURE_BINARY_LOG
+    static void decodeRecord(const LogRecord &rec, LogEvent &event);
+#endif
+
+    /* Formats the name of the log file (or its index) for the given month (8+1+3=12 chars+null) */
+    void formatFileName(char *buf, int year, int month);
+    void formatIndexName(char *buf, int year, int month);
+
+    /* Looks up where the messages for a day start in the log file for that month, and where
+     * the next day's messages start (or LOG_INDEX_UNSET if there aren't any yet). Returns 
+     * LOG_DAY_FOUND, or LOG_DAY_EMPTY if there are no messages for that day, or LOG_DAY_UNKNOWN
+     * if the index doesn't cover that day and the whole log has to be searched. */
+    int findDay(int year, int month, int day, unsigned long &start, unsigned long &end);
+
+    /* Writes out the messages waiting in the queue. Call this when the program is idle, and
+     * before anything reads the log files. */
+    void flush();
+
+    /* The number of messages waiting to be written out */
+    int pending() { return queueCount; }
+
+    /* The number of messages written out straight away because the queue was full, and the 
+     * most messages that have been waiting at once */
+    unsigned int overflows;
+    byte queuedMax;
+
+    /* Closes the log file. It is opened again by the next message. */
+    void close();
+
 };
 
 /* The global logger */
@@ -0,0 +1,79 @@
+/*
+ * haus|prox - Electronic door access control system
+ * Copyright (C) 2011  Peter Rogers (peter.rogers@gmail.com)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PINS_H__
+#define __PINS_H__
+
+/* Pins.h */
+
+#include "Arduino.h"
+
+/* Card reader */
+#define PIN_CLOCK             3
+#define PIN_DATA              4
+#define PIN_PRESENT           5
+#define PIN_BEEP              6
+
+#define PIN_DOOR_LATCH        2
+
+#define PIN_OPEN_HOUSE_BTN    7
+
+/* Chip select for the SD card */
+#define PIN_SD_CHIPSEL        10
+
+/* A digital pin fixed at compile time. On the ATmega168/328 each pin is a bit in one of the port 
+ * registers, and the register and mask are picked by the compiler, so reading or writing the pin 
+ * is a direct register access rather than the table lookups done at runtime by digitalRead and 
+ * digitalWrite. That matters in the card reader interrupt, which runs for every bit the reader 
+ * sends. (The saving hasn't been measured on the board.) On other boards, and in host builds, 
+ * the pin falls back on the arduino functions, where utils/host simulates the pins. */
+#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega168__)
+
+/* Pins 0-7 are on port D, 8-13 on port B and 14-19 (the analog pins) on port C */
+#define PIN_PORT_REG(pin, d, b, c)  ((pin) < 8 ? (d) : ((pin) < 14 ? (b) : (c)))
+#define PIN_PORT_BIT(pin)           ((pin) < 8 ? (pin) : ((pin) < 14 ? (pin)-8 : (pin)-14))
+
+template <int PIN>
+class FastPin
+{
+  public:
+    static const byte mask = (1 << PIN_PORT_BIT(PIN));
+
+    static inline void output() { PIN_PORT_REG(PIN, DDRD, DDRB, DDRC) |= mask; }
+    static inline void input() { PIN_PORT_REG(PIN, DDRD, DDRB, DDRC) &= ~mask; }
+    static inline boolean read() { return (PIN_PORT_REG(PIN, PIND, PINB, PINC) & mask) != 0; }
+    static inline void high() { PIN_PORT_REG(PIN, PORTD, PORTB, PORTC) |= mask; }
+    static inline void low() { PIN_PORT_REG(PIN, PORTD, PORTB, PORTC) &= ~mask; }
+};
+
+#else
+
+template <int PIN>
+class FastPin
+{
+  public:
+    static inline void output() { pinMode(PIN, OUTPUT); }
+    static inline void input() { pinMode(PIN, INPUT); }
+    static inline boolean read() { return digitalRead(PIN) == HIGH; }
+    static inline void high() { digitalWrite(PIN, HIGH); }
+    static inline void low() { digitalWrite(PIN, LOW); }
+};
+
+#endif
+
+#endif
@@ -23,22 +23,13 @@
 
 #include "Prox.h"
 #include "Const.h"
+#include "Pins.h"
 
 /*************/
 /* Constants */
 /*************/
 
-#define PIN_CLOCK             3
-#define PIN_DATA              4
-#define PIN_PRESENT           5
-#define PIN_BEEP              6
-
-#define PIN_DOOR_LATCH        2
-
-#define PIN_OPEN_HOUSE_BTN    7
-
-/* Chip select for the SD card */
-#define PIN_SD_CHIPSEL        10
+typedef FastPin<PIN_OPEN_HOUSE_BTN> OpenHouseButtonPin;
 
 /* The hausprox config file */
 #define CONFIG_FILE       "hausprox.cfg"
@@ -59,25 +50,31 @@ HausProx::HausProx()
   openHouseDuration = DEFAULT_OPEN_HOUSE_LEN;
   doorEntryDuration = DEFAULT_OPEN_DOOR_LEN;
   lastDoorLocked = true;
+  lastCardPresent = false;
+  swipeWarmed = false;
+  memset(&timeline, 0, sizeof(timeline));
+  tickCount = 0;
   strcpy(password, DEFAULT_PASSWORD);
 }
 
 void HausProx::begin()
 {
   /* Set the open house button pin and internal pull-up resistor */
-  pinMode(PIN_OPEN_HOUSE_BTN, INPUT);
-  digitalWrite(PIN_OPEN_HOUSE_BTN, HIGH);
+  OpenHouseButtonPin::input();
+  OpenHouseButtonPin::high();
 
   /* Initialize the I2C bus for interfacing with the clock (arduino is bus master) */
   Wire.begin();
+  /* Start the software clock from the RTC, so the bootup messages have the right time */
+  clock.sync();
 
   pinMode(PIN_SD_CHIPSEL, OUTPUT);
 
   /* Setup the card reader */
-  reader.begin(PIN_DATA, PIN_CLOCK, PIN_PRESENT, PIN_BEEP);
+  reader.begin();
 
   /* Setup the door control */
-  door.begin(PIN_DOOR_LATCH);
+  door.begin();
 
   initSDCard();
   if (! sdEnabled ) {
@@ -87,6 +84,14 @@ void HausProx::begin()
   }
 
   loadConfig();
+
+  /* Check the card index is in step with the database (it is rebuilt in the background if not) */
+  if (sdEnabled) {
+    int ret = database.begin();
+    if (ret != DATABASE_SUCCESS) {
+      logger.logMessage(LOG_ERROR, CardDatabase::getErrorStr(ret));
+    }
+  }
   
   // Log the bootup message
   logger.logMessage(LOG_MESG, strBootupMessage);
@@ -94,8 +99,11 @@ void HausProx::begin()
   /* The door starts locked */
   lockDoor();
 
+  /* Write out the bootup messages (while they still go to the serial port as well) */
+  logger.flush();
+
   // Have the reader make a short beep
-  reader.beep(500);
+  reader.playStartupBeep();
 }
 
 void HausProx::initSDCard()
@@ -143,16 +151,57 @@ void HausProx::handleEvents()
   }
   lastDoorLocked = locked;
   
-  /* Check if a card has been scanned */
+  /* Check if a card is being presented, then if one has been scanned */
+  handleCardPresent();
   handleCardScanned();
 
   /* Check if the open|haus button has been pressed */
   handleOpenHouse();
+
+  /* Write out the waiting log messages while no card is being read, or straight away if the
+   * queue is getting full */
+  int pending = logger.pending();
+  if (pending >= LOG_QUEUE_HIGH_WATER || 
+      (pending > 0 && !reader.isCardPresent() && !reader.hasCardData())) {
+    logger.flush();
+  }
+
+  /* Correct the software clock from the RTC now and then, and carry on with any rebuild of the
+   * card index, but not while a card is being read */
+  if (!reader.isCardPresent() && !reader.hasCardData()) {
+    clock.poll();
+    if (sdEnabled) {
+      int ret = database.poll();
+      if (ret != DATABASE_SUCCESS) {
+        logger.logMessage(LOG_ERROR, CardDatabase::getErrorStr(ret));
+      }
+    }
+  }
 }
 
-/* Called to handle a card being scanned. The data is actually buffered up by the interrupt handler
- * attached to the clock pin. When sufficient data has been captured (255 bytes) this function 
- * will process the data, scan the database, etc. */
+/* Called to handle a card being presented to the reader. The reader asserts the card present line a
+ * few milliseconds before the card number has been clocked out, so we use that time to open the 
+ * database and read the start of the index search into the SD card's buffer. The lookup then only 
+ * has to do the rest. */
+void HausProx::handleCardPresent()
+{
+  boolean present = reader.isCardPresent();
+  if (present && !lastCardPresent && readerOpensDoor)
+  {
+    timeline.present = micros();
+    if (sdEnabled) {
+      /* Any error shows up again (and is logged) when the card is looked up */
+      database.prewarm();
+    }
+    timeline.warmed = micros();
+    swipeWarmed = true;
+  }
+  lastCardPresent = present;
+}
+
+/* Called to handle a card being scanned. The data is actually buffered up and decoded by the interrupt 
+ * handler attached to the clock pin. As soon as the card number has been decoded (before the trailing 
+ * zeros have finished clocking in) this function will scan the database, etc. */
 void HausProx::handleCardScanned()
 {
   if (!readerOpensDoor) {
@@ -166,9 +215,17 @@ void HausProx::handleCardScanned()
     return;
   }
 
+  /* Note when the card was decoded. If the card present edge was missed (eg the main loop was busy)
+   * nothing was warmed up for this card. */
+  timeline.decoded = reader.getFrameTime();
+  if (!swipeWarmed) {
+    timeline.present = timeline.warmed = timeline.decoded;
+  }
+  swipeWarmed = false;
+
   // Read the card data
-  char serial[READER_SERIAL_BUF_LEN];
-  int err = reader.readCard(serial, sizeof(serial));
+  cardkey_t key;
+  int err = reader.readCard(key);
 
   // Interpret the results
   if (err != 0) {
@@ -176,25 +233,33 @@ void HausProx::handleCardScanned()
     logger.logMessage(LOG_ERROR, CardReader::getErrorStr(err), NULL, &reader);
     // Clear the card buffer
     reader.clearCardData();
+    timeline.decided = micros();
     return;
   }
 
   // Clear the card buffer
   reader.clearCardData();
 
+  checkCard(key);
+  timeline.decided = micros();
+}
+
+/* Looks up a scanned card, then admits or denies the card holder */
+void HausProx::checkCard(cardkey_t key)
+{
   /* Scan the database */
   CardInfo info;
-  int ret = database.lookupCard(serial, info);
+  int ret = database.lookupCard(key, info);
 
   if (ret == DATABASE_RECORD_NOT_FOUND) {
     /* The card isn't in the database */
     reader.playFailBeep();
-    logger.logMessage(LOG_CARD, strDenyUnregCard, serial);
+    logger.logMessage(LOG_CARD, strDenyUnregCard, key);
     return;
 
   } else if (ret != DATABASE_SUCCESS) {
     /* Log the error */
-    logger.logMessage(LOG_ERROR, CardDatabase::getErrorStr(ret), serial);
+    logger.logMessage(LOG_ERROR, CardDatabase::getErrorStr(ret), key);
     return;
   }
 
@@ -203,16 +268,16 @@ void HausProx::handleCardScanned()
     /* Card holder is granted access */
     if (openHouseMode) {
       /* Already in open house mode, so whatever */
-      logger.logMessage(LOG_CARD, strValidOpenHouse, info.serial);
+      logger.logMessage(LOG_CARD, strValidOpenHouse, key);
     } else {
       /* Log the entry message */
-      logger.logMessage(LOG_CARD, strAdmitEntry, info.serial);
+      logger.logMessage(LOG_CARD, strAdmitEntry, key);
       unlockDoor(doorEntryDuration);
     }
   } else {
     /* The card is disabled */
     reader.playFailBeep();
-    logger.logMessage(LOG_CARD, strDenyDisabledCard, info.serial);
+    logger.logMessage(LOG_CARD, strDenyDisabledCard, key);
   }
 }
 
@@ -220,7 +285,7 @@ void HausProx::handleCardScanned()
 void HausProx::handleOpenHouse()
 {
   /* Update the open house toggle button (handles debouncing) */
-  boolean n = (digitalRead(PIN_OPEN_HOUSE_BTN) == LOW);
+  boolean n = !OpenHouseButtonPin::read();
   openHouseButton.update(n);
   /* Check if somebody has pressed the button (goes low to high) */
   if (openHouseButton.changed && openHouseButton.state) 
@@ -246,7 +311,13 @@ boolean HausProx::checkPassword(const char *input)
 
 void HausProx::tick()
 {
-  door.tick();
+  reader.tick(TICK_MS);
+  /* The clock and door count in seconds */
+  if (++tickCount == TICKS_PER_SECOND) {
+    tickCount = 0;
+    clock.tick();
+    door.tick();
+  }
 }
 
 boolean HausProx::loadConfig()
@@ -295,6 +366,29 @@ boolean HausProx::loadConfig()
     } else if (prog_str_equals(strConfigOpenHouse, name) && value) {
       // Open house length
       openHouseDuration = atol(value);
+    } else if (prog_str_equals(strConfigCardFormat, name) && prog_str_equals(strConfigBinary, value)) {
+      // Card database stored as packed binary records
+      database.setFormat(DATABASE_FORMAT_BINARY);
+    } else if (prog_str_equals(strConfigCardFormat, name) && prog_str_equals(strConfigText, value)) {
+      // Card database stored as ascii text
+      database.setFormat(DATABASE_FORMAT_TEXT);
+    } else if (prog_str_equals(strConfigCardFormat, name) && prog_str_equals(strConfigWide, value)) {
+      // Card database stored as ascii text, with room for cards wider than 26 bits
+      database.setFormat(DATABASE_FORMAT_WIDE);
+#if FEATURE_BINARY_LOG
+    } else if (prog_str_equals(strConfigLogFormat, name) && prog_str_equals(strConfigBinary, value)) {
+      // Log files stored as packed binary records
+      logger.format = LOG_FORMAT_BINARY;
+#endif
+    } else if (prog_str_equals(strConfigLogFormat, name) && prog_str_equals(strConfigText, value)) {
+      // Log files stored as lines of text
+      logger.format = LOG_FORMAT_TEXT;
+    } else if (prog_str_equals(strConfigClockSync, name) && value) {
+      // How often (seconds) to correct the software clock from the RTC
+      clock.syncInterval = atol(value);
+    } else if (prog_str_equals(strConfigReaderTimeout, name) && value) {
+      // Gap between bits (ms) that ends a card frame
+      reader.bitTimeout = atol(value)*1000;
     } else {
       logger.logMessage(LOG_ERROR, strConfigInvalid);
       Serial.println(name);
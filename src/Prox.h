@@ -31,6 +31,24 @@
 /* The maximum admin password length */
 #define PASSWORD_BUF_LEN      16
 
+/* How often the timer interrupt calls 'tick' (ms) */
+#define TICK_MS               10
+#define TICKS_PER_SECOND      (1000/TICK_MS)
+
+/* When each stage of the last card swipe happened (micros). The database is warmed up between the 
+ * card being presented and its number being decoded, so that work overlaps with reading the card. */
+struct SwipeTimeline
+{
+  /* The card present line was asserted (as seen by the main loop) */
+  unsigned long present;
+  /* The database files and clock were ready */
+  unsigned long warmed;
+  /* The card number was decoded (by the interrupt) */
+  unsigned long decoded;
+  /* The card was admitted or denied */
+  unsigned long decided;
+};
+
 class HausProx
 {
   public:
@@ -62,6 +80,13 @@ class HausProx
     /* Whether scanning a card is able to currently open the door */
     boolean        readerOpensDoor;
 
+    /* Whether the card present line was asserted the last time we checked */
+    boolean        lastCardPresent;
+    /* Whether the database was warmed up for the card being read */
+    boolean        swipeWarmed;
+    /* The stages of the last card swipe */
+    SwipeTimeline  timeline;
+
     HausProx();
 
     void begin();
@@ -71,11 +96,15 @@ class HausProx
     void unlockDoor(long duration);
   
     void handleEvents();
+    void handleCardPresent();
     void handleCardScanned();
+    void checkCard(cardkey_t key);
     void handleOpenHouse();
 
-    // Called once every second to update the internal state
+    /* Called every TICK_MS from the timer interrupt to update the internal state */
     void tick();
+    /* The number of ticks since the door was last ticked */
+    byte           tickCount;
 
     /* Loads the program config from the SD card (eg password, door open duration, etc) */
     boolean loadConfig();
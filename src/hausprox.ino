@@ -23,6 +23,8 @@
 #include <TimerOne.h>
 
 #include "Prox.h"
+#include "Features.h"
+#include "LogQuery.h"
 #include "Const.h"
 
 // Convenience macro for printing yes/no
@@ -94,7 +96,7 @@ boolean read_card(CardInfo &info)
   {
     /* Prompt the user for the slot number */
     read_input(strSlotPrompt);
-    int slot = atoi(input);
+    slot_t slot = atol(input);
     if (slot == 0) {
       println_prog_str(strAborted);
       return false;
@@ -172,7 +174,7 @@ boolean wait_for_card()
 void print_card_cb(CardInfo &info)
 {
   Serial.print('[');
-  Serial.print((int)info.slot);
+  Serial.print(info.slot);
   Serial.print(']');
   Serial.print(' ');
   Serial.print(info.serial);
@@ -248,6 +250,12 @@ void command_status()
   clock.formatDateTime(input, MAX_INPUT_LEN);
   print_prog_str(strDateStatus);
   Serial.println(input);
+  /* Display whether the RTC could be read, and how far the software clock had drifted from it */
+  print_prog_str(strClockSyncStatus);
+  print_prog_str(YESNO(clock.synced));
+  print_prog_str(strClockDriftStatus);
+  Serial.print(clock.drift);
+  Serial.println(" s");
   /* Display the door entry duration */
   print_prog_str(strDoorLenStatus);
   Serial.print(hausProx.doorEntryDuration);
@@ -256,6 +264,51 @@ void command_status()
   print_prog_str(strOpenLenStatus);
   Serial.print(hausProx.openHouseDuration);
   Serial.println(" s");
+  /* Display how many lookups were answered without reading the SD card */
+  print_prog_str(strCacheStatus);
+  Serial.print(hausProx.database.cacheHits);
+  print_prog_str(strCacheMisses);
+  Serial.println(hausProx.database.cacheMisses);
+  /* Display how many partial card frames were thrown away */
+  print_prog_str(strReaderTimeoutStatus);
+  Serial.println(hausProx.reader.timeouts);
+  /* Display how many cards were lost because the queue of swipes filled up */
+  print_prog_str(strReaderDroppedStatus);
+  Serial.print(hausProx.reader.framesDropped);
+  print_prog_str(strReaderQueuedStatus);
+  Serial.println((int)hausProx.reader.framesQueuedMax);
+  /* Display how many cards were read despite the reader slipping a bit */
+  print_prog_str(strReaderRecoveredStatus);
+  Serial.println(hausProx.reader.framesRecovered);
+  /* Display how often the log queue filled up before it could be written out */
+  print_prog_str(strLogOverflowStatus);
+  Serial.print(logger.overflows);
+  print_prog_str(strReaderQueuedStatus);
+  Serial.println((int)logger.queuedMax);
+  /* Display how long the last swipe took, and how much of the lookup was done while the card was read */
+  SwipeTimeline &t = hausProx.timeline;
+  long warmed = (long)(t.warmed - t.present);
+  long overlap = (long)(t.decoded - t.present);
+  if (overlap > warmed) overlap = warmed;
+  if (overlap < 0) overlap = 0;
+  print_prog_str(strSwipeReadStatus);
+  Serial.print((long)(t.decoded - t.present));
+  print_prog_str(strSwipeDecideStatus);
+  Serial.print(t.decided - t.decoded);
+  println_prog_str(strMicros);
+  print_prog_str(strSwipeWarmStatus);
+  Serial.print(warmed);
+  print_prog_str(strSwipeOverlapStatus);
+  Serial.print(overlap);
+  println_prog_str(strMicros);
+  /* Display how much SRAM is left between the heap and the stack, now and at the deepest the 
+   * stack has been since startup */
+  print_prog_str(strFreeMemoryStatus);
+  Serial.print(free_memory());
+  println_prog_str(strBytes);
+  print_prog_str(strStackHeadroomStatus);
+  Serial.print(stack_headroom());
+  println_prog_str(strBytes);
 }
 
 /******************/
@@ -321,9 +374,9 @@ boolean card_management_add()
   CardInfo info;
   int ret;
 
-  // Read the serial number
-  while(1) 
+  while(1)
   {
+    // Read the serial number
     read_input(strCardPrompt);
     if (input[0] == 0) {
       // Aborted adding
@@ -332,37 +385,32 @@ boolean card_management_add()
     }
     // Trim the newline
     trim(input);
-    if (strlen(input) != SERIAL_LEN) {
+    ret = hausProx.database.normalizeSerial(input);
+    if (ret == DATABASE_CARD_TOO_WIDE) {
+      println_prog_str(strCardTooWide);
+      continue;
+    } else if (ret != DATABASE_SUCCESS) {
       // Bad serial number
       println_prog_str(strInvalidEntry);
       continue;
     }
+    strcpy(info.serial, input);
 
-    // Make sure the serial doesn't already exist
-    ret = hausProx.database.lookupCard(input, info);
-    if (ret == DATABASE_RECORD_NOT_FOUND || ret == DATABASE_DOES_NOT_EXIST) {
-      // The serial is not taken or the database doesn't exist
-      break;
-    } else if (ret == DATABASE_SUCCESS) {
-      // Serial is already taken
-      println_prog_str(strSerialExists);
-    } else {
-      println_prog_str(CardDatabase::getErrorStr(ret));
-      return true;
+    // Prompt the user for the enabled flag
+    ret = read_yesno(strActivePrompt);
+    if (ret == -1) {
+        println_prog_str(strAborted);
+        return false;
     }
-  }
-  strcpy(info.serial, input);
+    info.enabled = ret;
 
-  // Prompt the user for the enabled flag
-  ret = read_yesno(strActivePrompt);
-  if (ret == -1) {
-      println_prog_str(strAborted);
-      return false;
+    /* Now attempt to insert the card into the database. This checks the serial isn't 
+     * already taken in the same pass that finds a free slot for it. */
+    ret = hausProx.insertCard(info);
+    if (ret != DATABASE_ALREADY_EXISTS) break;
+    // Serial is already taken
+    println_prog_str(strSerialExists);
   }
-  info.enabled = ret;
-
-  // Now attempt to insert the card into the database
-  ret = hausProx.insertCard(info);
   // Display the result (will also print 'Success' on success)
   println_prog_str(CardDatabase::getErrorStr(ret));
   return true;
@@ -387,6 +435,7 @@ void card_management_scan(boolean add)
       /* Log the error and the contents of the card buffer */
       println_prog_str(CardReader::getErrorStr(err));
       hausProx.reader.printBuffer(Serial);
+      hausProx.reader.clearCardData();
       continue;
     }
 
@@ -435,7 +484,8 @@ void card_management_edit()
     }
     // Trim the newline
     trim(input);
-    if (strlen(input) == SERIAL_LEN)
+    int ret = hausProx.database.normalizeSerial(input);
+    if (ret == DATABASE_SUCCESS)
     {
       // Change the serial
       strcpy(info.serial, input);
@@ -443,7 +493,7 @@ void card_management_edit()
       break;
     }
     // Try again
-    println_prog_str(strInvalidEntry);
+    println_prog_str(ret == DATABASE_CARD_TOO_WIDE ? strCardTooWide : strInvalidEntry);
   }
 
   // Prompt the user for the enabled flag
@@ -546,12 +596,114 @@ void log_management_menu()
         // Monitor new additions to the log file
         log_management_monitor();
         break;
+#if FEATURE_LOG_QUERY
+      case '4':
+        // Search the logs for particular messages
+        log_management_query();
+        break;
+#endif
       case '9':
         return;
     }
   }
 }
 
+#if FEATURE_LOG_QUERY
+/* Prompts for a date/time range limit, filling in 'time'. Fields the user leaves off the end take
+ * their value from 'time'. Returns false if the input is blank. */
+boolean read_date_time(const prog_char *msg, DateTime &time)
+{
+  while(1) {
+    read_input(msg);
+    if (input[0] == 0) {
+      return false;
+    }
+    if (parse_date_time(input, time) > 0 && time.year <= 99 && time.month >= 1 && time.month <= 12) {
+      return true;
+    }
+    println_prog_str(strInvalidEntry);
+  }
+}
+
+/* Searches the logs for messages by card, type and time range */
+void log_management_query()
+{
+  LogQuery query;
+
+  println_prog_str(strQueryLogTitle);
+
+  // Enter a serial number, or just the facility code
+  while(1) {
+    read_input(strQueryCardPrompt);
+    if (input[0] == 0) {
+      break;
+    }
+    if (parse_serial(input, query.key)) {
+      query.filterKey = true;
+      break;
+    }
+    char *end;
+    long facility = strtol(input, &end, 10);
+    if (*end == 0 && facility >= 0 && facility <= MAX_FACILITY) {
+      query.facility = facility;
+      query.filterFacility = true;
+      break;
+    }
+    println_prog_str(strInvalidEntry);
+  }
+
+  // Enter the message type
+  read_input(strQueryTypePrompt);
+  switch(input[0]) {
+    case 'c':
+      query.level = LOG_CARD;
+      break;
+    case 'd':
+      query.level = LOG_DOOR;
+      break;
+    case 'e':
+      query.level = LOG_ERROR;
+      break;
+    case 'a':
+      query.level = LOG_ADMIN;
+      break;
+    case 'm':
+      query.level = LOG_MESG;
+      break;
+  }
+
+  // Enter the time range (default is from the start of this month until now)
+  clock.update();
+  clock.getDateTime(query.to);
+  query.from = query.to;
+  query.from.day = 1;
+  query.from.hours = query.from.minutes = query.from.seconds = 0;
+  DateTime time = {0, 1, 1, 0, 0, 0};
+  if (read_date_time(strQueryFromPrompt, time)) {
+    query.from = time;
+  }
+  DateTime last = {0, 12, 31, 23, 59, 59};
+  if (read_date_time(strQueryToPrompt, last)) {
+    query.to = last;
+  }
+  Serial.println();
+
+  /* Make sure the waiting log messages are in the files */
+  logger.flush();
+  query.run(Serial);
+
+  if (query.aborted) {
+    println_prog_str(strAborted);
+  }
+  print_prog_str(strQueryScanned);
+  Serial.print(query.bytesScanned);
+  print_prog_str(strQueryBytes);
+  Serial.print(query.elapsed);
+  print_prog_str(strQueryMatches);
+  Serial.println(query.matches);
+}
+#endif
+
 /* Logs all activity to the serial interface until the user presses enter */
 void log_management_monitor()
 {
@@ -598,7 +750,10 @@ void log_management_dump(boolean interactive)
     println_prog_str(strInvalidEntry);
   }
 
-  sprintf(input, "HP-%02d-%02d.LOG", year, month);
+  /* Make sure the waiting log messages are in the file */
+  logger.flush();
+
+  logger.formatFileName(input, year, month);
   File file = SD.open(input, FILE_READ);
   if (!file) {
     print_prog_str(strLogNotFound);
@@ -610,13 +765,46 @@ void log_management_dump(boolean interactive)
   print_prog_str(strSearchingLog);
   Serial.println(input);
   Serial.println();
+
+  /* Skip straight to the day's messages if the log index knows where they are. Otherwise the
+   * whole log is searched. */
+  unsigned long start = 0, end = LOG_INDEX_UNSET;
+  if (day != 0) {
+    int ret = logger.findDay(year, month, day, start, end);
+    if (ret == LOG_DAY_EMPTY) {
+      println_prog_str(strNoLogEntries);
+      file.close();
+      return;
+    }
+    if (ret != LOG_DAY_FOUND) {
+      start = 0;
+      end = LOG_INDEX_UNSET;
+    }
+  }
+
+#if FEATURE_BINARY_LOG
+  if (logger.format == LOG_FORMAT_BINARY) {
+    /* Binary logs are decoded back into lines of text */
+    if (!dump_binary_log(&file, day, start, end, interactive)) {
+      println_prog_str(strNoLogEntries);
+    }
+    file.close();
+    return;
+  }
+#endif
+
+  if (start > 0 && !file.seek(start)) {
+    println_prog_str(strNoLogEntries);
+    file.close();
+    return;
+  }
   
   boolean done = false, found=false;
-  // The number of lines processed in the log file
+  // The number of lines processed in the log file (counting from the start of the day if indexed)
   int count = 1;
   // The number of lines printed from the log file on the current "screen"
   int linesPrinted = 0;
-  while(!done)
+  while(!done && file.position() < end)
   {
     /* Since log lines may be arbitrarily long, we read them in small chunks. We want to handle the first
      * chunk specially, since we will use that in conjunction with our date filtering. */
@@ -689,6 +877,76 @@ void log_management_dump(boolean interactive)
   }
 }
 
+#if FEATURE_BINARY_LOG
+/* Prints the messages from a binary log file (for the given day, or 0 for all) the same way as
+ * log_management_dump prints a text log. Only the messages between offsets 'start' and 'end' 
+ * are searched (see Logger::findDay). Returns whether any messages were printed. */
+boolean dump_binary_log(File *file, int day, unsigned long start, unsigned long end, boolean interactive)
+{
+  byte buf[LOG_RECORD_LEN];
+  if (file->read(buf, LOG_RECORD_LEN) != LOG_RECORD_LEN || !check_log_header(buf)) {
+    return false;
+  }
+  if (start > LOG_RECORD_LEN && !file->seek(start)) {
+    return false;
+  }
+
+  boolean found = false;
+  // The number of messages processed in the log file (counting from the start of the day if indexed)
+  int count = 1;
+  // The number of lines printed from the log file on the current "screen"
+  int linesPrinted = 0;
+  while (file->position() < end && file->read(buf, LOG_RECORD_LEN) == LOG_RECORD_LEN)
+  {
+    LogRecord rec;
+    LogEvent event;
+    unpack_log_record(buf, rec);
+    Logger::decodeRecord(rec, event);
+    DateTime time;
+    epoch_to_date(event.time, time);
+
+    boolean outputLine = (day == 0 || day == time.day);
+    if (outputLine) {
+      found = true;
+      linesPrinted++;
+      Serial.print('[');
+      Serial.print(count);
+      Serial.print(']');
+      Serial.print(' ');
+      logger.printEvent(Serial, event, NULL);
+    }
+    count++;
+
+    /* Print (or skip over) the card frame stored after the message */
+    for (int bit = 0; bit < rec.frameBits; bit += 8*LOG_RECORD_LEN)
+    {
+      if (file->read(buf, LOG_RECORD_LEN) != LOG_RECORD_LEN) break;
+      for (int n = bit; outputLine && n < rec.frameBits && n < bit + 8*LOG_RECORD_LEN; n++) {
+        Serial.print((buf[(n-bit) >> 3] >> (n & 7)) & 1);
+      }
+    }
+    if (outputLine) {
+      Serial.println();
+    }
+
+    /* Let the user break out at any time */
+    if (Serial.available() > 0) {
+      /* Consume the input so it doesn't get picked up elsewhere */
+      while(Serial.available() > 0) Serial.read();
+      println_prog_str(strAborted);
+      break;
+    }
+    if (interactive && linesPrinted == LOG_LINES_PER_PAGE) {
+      // Wait for user input before continuing, or 'q' to quit
+      read_input(strPressEnter);
+      if (input[0] == 'q') break;
+      linesPrinted = 0;
+    }
+  }
+  return found;
+}
+#endif
+
 /*************/
 /* Main menu */
 /*************/
@@ -717,6 +975,8 @@ void main_menu()
         break;
       case '9':
         println_prog_str(strLogoutMessage);
+        /* Write out everything logged during the session */
+        logger.flush();
         return;
       default:
         println_prog_str(strInvalidEntry);
@@ -729,7 +989,7 @@ void main_menu()
 /* Handlers */
 /************/
 
-/* Called once every second by Timer1 */
+/* Called every TICK_MS by Timer1 */
 void timer_tick()
 {
   hausProx.tick();
@@ -747,15 +1007,19 @@ void receive_card_data()
 
 void setup()
 {
+  /* Before anything else uses the stack, so the status screen can show how deep it has been */
+  paint_stack();
+
   Serial.begin(9600);
   delay(200);
 
   /* Attach an interrupt to the card reader clock pin */
   attachInterrupt(1, receive_card_data, FALLING);
 
-  /* Start the 1-second interrupt timer. We use that for keeping track of how long the door has been open */
+  /* Start the interrupt timer. We use that for keeping track of how long the door has been open, and
+   * for playing beeps without holding up the main loop. */
   Timer1.attachInterrupt(timer_tick);
-  Timer1.initialize(1000000);
+  Timer1.initialize(TICK_MS*1000L);
   
   hausProx.begin();
   // Turn off serial logging
@@ -150,3 +150,42 @@ void trim(char *str)
   }
 }
 
+/* The start of the heap, and how far it has grown (both from avr-libc's malloc) */
+extern char __heap_start;
+extern char *__brkval;
+
+int free_memory()
+{
+  // The stack grows down towards the top of the heap
+  char top;
+  return &top - (__brkval != NULL ? __brkval : &__heap_start);
+}
+
+/* Painted over the free SRAM, and left alone until the stack grows down over it */
+#define STACK_PAINT 0xC5
+
+/* The bytes left unpainted below the stack pointer, for this function's own frame */
+#define STACK_PAINT_MARGIN 16
+
+void paint_stack()
+{
+  char top;
+  char *p = (__brkval != NULL ? __brkval : &__heap_start);
+  // Worked out on the address so the compiler doesn't treat it as indexing into 'top'
+  char *end = (char*)((size_t)&top - STACK_PAINT_MARGIN);
+  while (p < end) {
+    *p++ = STACK_PAINT;
+  }
+}
+
+int stack_headroom()
+{
+  char top;
+  char *p = (__brkval != NULL ? __brkval : &__heap_start);
+  int count = 0;
+  while (p < &top && *(byte*)p == STACK_PAINT) {
+    p++;
+    count++;
+  }
+  return count;
+}
@@ -66,5 +66,19 @@ byte encodeBCD(byte data);
 /* Trims whitespace characters from both ends of a string */
 void trim(char *buf);
 
+/* Returns the number of bytes of SRAM between the top of the heap and the stack (not counting
+ * blocks freed back into the heap). Called from near the top of the stack, this is what the 
+ * deepest calls and the interrupts have left to work with. */
+int free_memory();
+
+/* Fills the free SRAM between the heap and the stack with a marker. Call this first thing in 
+ * 'setup', so 'stack_headroom' can tell how deep the stack has been since. */
+void paint_stack();
+
+/* Returns the number of bytes above the heap the stack has never reached since 'paint_stack' (the
+ * low-water mark of free memory, interrupts included). Heap blocks allocated and freed since also
+ * count as used, so this errs on the low side. */
+int stack_headroom();
+
 #endif
 
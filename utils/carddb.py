@@ -0,0 +1,63 @@
+#!/usr/bin/env python
+
+#
+# Converts the card database between the ascii format (CARDS.TXT) and the
+# packed binary format (CARDS.BIN). See doc/Database.txt for both formats.
+#
+# usage: carddb.py tobin CARDS.TXT CARDS.BIN
+#        carddb.py totext CARDS.BIN CARDS.TXT
+#
+
+import struct
+import sys
+
+RECORD_LEN = 12
+BIN_RECORD_LEN = 4
+BIN_KEY_MASK = 0x00FFFFFF
+BIN_ENABLED = 0x01000000
+BIN_BLANK = 0xFFFFFFFF
+
+def to_binary(src, dst):
+	data = open(src, "rb").read()
+	if len(data) % RECORD_LEN != 0:
+		sys.exit("%s: size is not a multiple of %d bytes" % (src, RECORD_LEN))
+	out = open(dst, "wb")
+	for slot in range(len(data) // RECORD_LEN):
+		line = data[slot*RECORD_LEN:(slot+1)*RECORD_LEN].decode("ascii")
+		(serial, enabled) = line.rstrip("\n").split(",")
+		if serial == "Z"*9:
+			word = BIN_BLANK
+		else:
+			(facility, card) = serial.split("-")
+			(facility, card) = (int(facility), int(card))
+			if facility > 0xFF or card > 0xFFFF:
+				sys.exit("slot %d: serial %s does not fit a binary record" % (slot, serial))
+			word = (facility << 16) | card
+			if enabled == "1":
+				word |= BIN_ENABLED
+		out.write(struct.pack("<I", word))
+	out.close()
+
+def to_text(src, dst):
+	data = open(src, "rb").read()
+	if len(data) % BIN_RECORD_LEN != 0:
+		sys.exit("%s: size is not a multiple of %d bytes" % (src, BIN_RECORD_LEN))
+	out = open(dst, "wb")
+	for slot in range(len(data) // BIN_RECORD_LEN):
+		(word,) = struct.unpack("<I", data[slot*BIN_RECORD_LEN:(slot+1)*BIN_RECORD_LEN])
+		if word == BIN_BLANK:
+			line = "%s,0\n" % ("Z"*9)
+		else:
+			key = word & BIN_KEY_MASK
+			enabled = (word & BIN_ENABLED) and 1 or 0
+			line = "%03d-%05d,%d\n" % (key >> 16, key & 0xFFFF, enabled)
+		out.write(line.encode("ascii"))
+	out.close()
+
+if len(sys.argv) != 4 or sys.argv[1] not in ("tobin", "totext"):
+	sys.exit("usage: %s tobin|totext SRC DST" % sys.argv[0])
+
+if sys.argv[1] == "tobin":
+	to_binary(sys.argv[2], sys.argv[3])
+else:
+	to_text(sys.argv[2], sys.argv[3])
@@ -0,0 +1,162 @@
+/*
+ * Measures what checking and rebuilding the card index (src/CardDatabase.cpp) costs at bootup on
+ * a PC, using the SD library stand-in in utils/host. A text database of each size is written out
+ * with the cards in no particular order, then:
+ *
+ *  - begin is run with the index and free list up to date, which only checksums the database
+ *  - the index is deleted, begin is run again and the rebuild is driven to the end with poll,
+ *    counting the steps and the most SD card blocks any one step transfers
+ *  - a rebuild is started again, and a card is written part way through it (which restarts it)
+ *
+ * after which every card is looked up through the index. With the defaults it measures:
+ *
+ *    cards   check (blocks)   rebuild (blocks read / written)   steps   worst step (blocks)
+ *     1000         26               14620 /   7835                1602         26
+ *     5000        120               97956 /  51179                8002         37
+ *    20000        471              474641 / 244938               32002         46
+ *
+ * A block takes roughly a millisecond to read over SPI and a few to write, so checking a 20,000
+ * card database holds up bootup for about half a second (plus the checksum arithmetic), while 
+ * rebuilding its index takes around a quarter of an hour. That is why the rebuild runs in the 
+ * background, a step at a time, where the worst step holds up the main loop for 50-100ms.
+ *
+ * Build and run from the top of the tree:
+ *
+ *   g++ -O2 -Iutils/host -Isrc utils/dbboot.cpp utils/host/SD.cpp src/CardDatabase.cpp src/CardKey.cpp -o dbboot
+ *   ./dbboot [cards ...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "CardDatabase.h"
+
+static int failures = 0;
+
+/* The serial of the n'th card written, scattered over the short serial numbers */
+static void card_serial(unsigned long n, char *serial)
+{
+  unsigned long v = (n * 2654435761UL) % 16711680UL;
+  sprintf(serial, "%03u-%05u", (unsigned int)(1 + v/65536), (unsigned int)(v%65536));
+}
+
+/* Writes a text database of 'count' enabled cards */
+static void write_database(unsigned long count)
+{
+  SD.remove("cards.txt");
+  SD.remove("cards.idx");
+  SD.remove("cards.fre");
+  File file = SD.open("cards.txt", FILE_WRITE);
+  for (unsigned long n = 0; n < count; n++) {
+    char rec[16];
+    card_serial(n, rec);
+    strcat(rec, ",1\n");
+    file.write((const uint8_t*)rec, strlen(rec));
+  }
+  file.close();
+}
+
+/* Runs the background rebuild to the end, returning the number of steps and the most blocks
+ * transferred by one step */
+static unsigned long finish_rebuild(CardDatabase &db, unsigned long &worst)
+{
+  unsigned long steps = 0;
+  worst = 0;
+  while (db.isRebuilding())
+  {
+    SDStats before = sdStats;
+    if (db.poll() != DATABASE_SUCCESS) {
+      printf("  FAIL: rebuild gave up after %lu steps\n", steps);
+      failures++;
+    }
+    unsigned long blocks = (sdStats.blockReads - before.blockReads) + (sdStats.blockWrites - before.blockWrites);
+    if (blocks > worst) worst = blocks;
+    steps++;
+  }
+  return steps;
+}
+
+/* Checks the card in slot 'n' can be found through the index */
+static boolean check_card(CardDatabase &db, const char *serial, unsigned long n, const char *when)
+{
+  CardInfo info;
+  char buf[SERIAL_LEN+1];
+  strcpy(buf, serial);
+  SDStats before = sdStats;
+  int ret = db.lookupCard(buf, info);
+  /* A scan would read the whole database, the index only a few entries */
+  if (ret != DATABASE_SUCCESS || info.slot != n || sdStats.reads - before.reads > 40) {
+    printf("  FAIL: card %s (slot %lu) %s\n", serial, n, when);
+    failures++;
+    return false;
+  }
+  return true;
+}
+
+/* Checks every card from slot 'first' on can be found through the index */
+static void check_cards(CardDatabase &db, unsigned long first, unsigned long count, const char *when)
+{
+  char serial[SERIAL_LEN+1];
+  for (unsigned long n = first; n < count; n++) {
+    card_serial(n, serial);
+    if (!check_card(db, serial, n, when)) return;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  unsigned long sizes[] = {1000, 5000, 20000};
+  int count = sizeof(sizes)/sizeof(sizes[0]);
+  for (int n = 1; n < argc && n <= count; n++) {
+    sizes[n-1] = atol(argv[n]);
+    count = argc-1;
+  }
+
+  for (int n = 0; n < count; n++)
+  {
+    unsigned long cards = sizes[n];
+    unsigned long worst, steps;
+    write_database(cards);
+    printf("%lu cards (%lu bytes)\n", cards, cards*12);
+
+    /* The first bootup builds the index and free list */
+    CardDatabase db;
+    db.begin();
+    finish_rebuild(db, worst);
+    db.close();
+
+    SDStats before = sdStats;
+    db.begin();
+    printf("  check at bootup     %8lu blocks read %8lu written\n",
+           sdStats.blockReads - before.blockReads, sdStats.blockWrites - before.blockWrites);
+    check_cards(db, 0, cards, "after bootup");
+    db.close();
+
+    SD.remove("cards.idx");
+    before = sdStats;
+    db.begin();
+    steps = finish_rebuild(db, worst);
+    printf("  rebuild             %8lu blocks read %8lu written %8lu steps (worst %lu blocks)\n",
+           sdStats.blockReads - before.blockReads, sdStats.blockWrites - before.blockWrites, steps, worst);
+    check_cards(db, 0, cards, "after rebuild");
+    db.close();
+
+    /* Replace the first card half way through a rebuild */
+    SD.remove("cards.idx");
+    db.begin();
+    for (unsigned long step = 0; step < steps/2; step++) db.poll();
+    CardInfo info;
+    strcpy(info.serial, "000-00000");
+    info.enabled = true;
+    if (db.putCard(0, info) != DATABASE_SUCCESS) {
+      printf("  FAIL: putCard during rebuild\n");
+      failures++;
+    }
+    finish_rebuild(db, worst);
+    check_card(db, "000-00000", 0, "after a change during the rebuild");
+    check_cards(db, 1, cards, "after a change during the rebuild");
+    db.close();
+  }
+  printf(failures ? "%d checks failed\n" : "All checks passed\n", failures);
+  return failures ? 1 : 0;
+}
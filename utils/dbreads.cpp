@@ -0,0 +1,89 @@
+/*
+ * Counts the SD card reads made by card lookups (src/CardDatabase.cpp) on a PC, using the SD
+ * library stand-in in utils/host. A text database of each size is written out, then a card that
+ * isn't there and the last card are looked up, first by scanning the database (no index) and 
+ * then through the card index.
+ *
+ * For comparison, reading the database a byte at a time (as the sketch originally did) takes one
+ * read per byte, and reading it a record at a time one read per card. The scan reads 
+ * SCAN_BUFFER_LEN bytes (10 text records) at a time, so a scan for a card that isn't there takes:
+ *
+ *    cards   per byte   per card   scan   index
+ *     1000     12001      1001      101     10
+ *    10000    120001     10001     1001     14
+ *    50000    600001     50001     5001     16
+ *
+ * The SD library caches the 512 byte sector being read, so the scan still only reads each sector
+ * from the card once.
+ *
+ * Build and run from the top of the tree:
+ *
+ *   g++ -O2 -Iutils/host -Isrc utils/dbreads.cpp utils/host/SD.cpp src/CardDatabase.cpp src/CardKey.cpp -o dbreads
+ *   ./dbreads [cards ...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "CardDatabase.h"
+
+/* Writes a text database of 'count' enabled cards */
+static void write_database(unsigned long count)
+{
+  SD.remove("cards.txt");
+  SD.remove("cards.idx");
+  SD.remove("cards.fre");
+  File file = SD.open("cards.txt", FILE_WRITE);
+  for (unsigned long n = 0; n < count; n++) {
+    char rec[16];
+    sprintf(rec, "%03u-%05u,1\n", (unsigned int)(1 + n/60000), (unsigned int)(n%60000));
+    file.write((const uint8_t*)rec, strlen(rec));
+  }
+  file.close();
+}
+
+/* Looks up a serial, printing the reads it took */
+static void lookup(CardDatabase &db, const char *label, const char *serial)
+{
+  char buf[SERIAL_LEN+1];
+  CardInfo info;
+  strcpy(buf, serial);
+  SDStats before = sdStats;
+  int ret = db.lookupCard(buf, info);
+  printf("  %-22s %-9s %-18s %8lu reads %9lu bytes %6lu seeks\n", label, serial, 
+         ret == DATABASE_SUCCESS ? "found" : "not found", sdStats.reads - before.reads, 
+         sdStats.readBytes - before.readBytes, sdStats.seeks - before.seeks);
+}
+
+int main(int argc, char **argv)
+{
+  unsigned long sizes[] = {1000, 10000, 50000};
+  int count = sizeof(sizes)/sizeof(sizes[0]);
+  for (int n = 1; n < argc && n <= count; n++) {
+    sizes[n-1] = atol(argv[n]);
+    count = argc-1;
+  }
+
+  for (int n = 0; n < count; n++)
+  {
+    unsigned long cards = sizes[n];
+    char last[24];
+    sprintf(last, "%03u-%05u", (unsigned int)(1 + (cards-1)/60000), (unsigned int)((cards-1)%60000));
+    write_database(cards);
+    printf("%lu cards (%lu bytes). One read per byte: %lu reads, one read per card: %lu reads\n", 
+           cards, cards*12, cards*12 + 1, cards + 1);
+
+    /* Without the index (begin hasn't been called), every lookup scans the database */
+    CardDatabase scan;
+    lookup(scan, "scan", "255-65535");
+    lookup(scan, "scan", last);
+
+    CardDatabase indexed;
+    indexed.begin();
+    while (indexed.isRebuilding()) indexed.poll();
+    lookup(indexed, "index", "255-65534");
+    lookup(indexed, "index", last);
+    indexed.close();
+  }
+  return 0;
+}
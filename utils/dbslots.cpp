@@ -0,0 +1,145 @@
+/*
+ * Checks card database slot numbers and record offsets past 16 bits on a PC, using the SD library
+ * stand-in in utils/host. A 100,000 record database is written out as text and converted to each 
+ * format by CardDatabase::begin (and indexed by CardDatabase::poll), then cards are read, 
+ * looked up (through the index and by scanning) and written at the slots where 16-bit arithmetic 
+ * used to break, and either side of the scan buffer boundaries. Blank slots are then refilled by
+ * insertCard, and a card is appended at slot 100000.
+ *
+ * Build and run from the top of the tree:
+ *
+ *   g++ -O2 -Iutils/host -Isrc utils/dbslots.cpp utils/host/SD.cpp src/CardDatabase.cpp src/CardKey.cpp -o dbslots
+ *   ./dbslots
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "CardDatabase.h"
+
+#define NUM_RECORDS   100000UL
+
+static const char *formatNames[] = {"text", "binary", "wide"};
+static int failures = 0;
+
+static void check(boolean ok, const char *what, unsigned long slot)
+{
+  if (!ok) {
+    printf("  FAIL: %s at slot %lu\n", what, slot);
+    failures++;
+  }
+}
+
+/* The serial number stored at each slot. Every format can hold these. */
+static void slot_serial(unsigned long slot, char *serial)
+{
+  sprintf(serial, "%03u-%05u", (unsigned int)(1 + slot/60000), (unsigned int)(slot%60000));
+}
+
+/* Checks the card at 'slot' can be read back, and found by its serial number */
+static void check_slot(CardDatabase &db, unsigned long slot, const char *how)
+{
+  CardInfo info;
+  char serial[SERIAL_LEN+1];
+  slot_serial(slot, serial);
+  int ret = db.getCard(slot, info);
+  check(ret == DATABASE_SUCCESS && strcmp(info.serial, serial) == 0 && info.slot == slot, "getCard", slot);
+  ret = db.lookupCard(serial, info);
+  check(ret == DATABASE_SUCCESS && info.slot == slot, how, slot);
+}
+
+static void run(int fmt)
+{
+  printf("%s database, %lu records\n", formatNames[fmt], NUM_RECORDS);
+  SD.remove("cards.txt");
+  SD.remove("cards.bin");
+  SD.remove("wcards.txt");
+  SD.remove("cards.idx");
+  SD.remove("cards.fre");
+
+  /* Write out a text database (see doc/Database.txt), then let begin convert it to the format
+   * being tested and build the index and free list */
+  File file = SD.open("cards.txt", FILE_WRITE);
+  for (unsigned long slot = 0; slot < NUM_RECORDS; slot++) {
+    char rec[16];
+    slot_serial(slot, rec);
+    strcat(rec, ",1\n");
+    file.write((const uint8_t*)rec, strlen(rec));
+  }
+  file.close();
+  CardDatabase db;
+  db.setFormat(fmt);
+  if (db.begin() != DATABASE_SUCCESS) {
+    check(false, "begin", 0);
+    return;
+  }
+  while (db.isRebuilding()) {
+    check(db.poll() == DATABASE_SUCCESS, "rebuilding the index", 0);
+  }
+  CardInfo info;
+
+  /* Slots around the old 16-bit limits (5461 records of 12 bytes, and 65535), and either side 
+   * of the first scan buffer boundary for every format (6, 10 or 30 records) */
+  unsigned long slots[] = {0, 5, 6, 9, 10, 29, 30, 5460, 5461, 5462, 65535, 65536, 65537, NUM_RECORDS-1};
+  int numSlots = sizeof(slots)/sizeof(slots[0]);
+
+  /* Without the index (begin isn't called), every lookup scans the database */
+  CardDatabase scan;
+  scan.setFormat(fmt);
+  for (int n = 0; n < numSlots; n++) {
+    check_slot(scan, slots[n], "lookupCard (scan)");
+  }
+  scan.close();
+
+  for (int n = 0; n < numSlots; n++) {
+    check_slot(db, slots[n], "lookupCard (index)");
+  }
+
+  /* Rewrite some of them disabled, then blank two so insertCard has to find them */
+  for (int n = 0; n < numSlots; n++) {
+    slot_serial(slots[n], info.serial);
+    info.enabled = false;
+    check(db.putCard(slots[n], info) == DATABASE_SUCCESS, "putCard", slots[n]);
+    check(db.getCard(slots[n], info) == DATABASE_SUCCESS && !info.enabled, "putCard (disabled)", slots[n]);
+  }
+  unsigned long blanks[] = {65536, 5461};
+  for (int n = 0; n < 2; n++) {
+    info.setBlank();
+    check(db.putCard(blanks[n], info) == DATABASE_SUCCESS, "putCard (blank)", blanks[n]);
+  }
+
+  /* The lowest blank slot is reused first, then the other, then the card is appended */
+  unsigned long expected[] = {5461, 65536, NUM_RECORDS};
+  for (int n = 0; n < 3; n++) {
+    sprintf(info.serial, "200-%05d", n);
+    info.enabled = true;
+    check(db.insertCard(info) == DATABASE_SUCCESS, "insertCard", expected[n]);
+    CardInfo found;
+    check(db.lookupCard(info.serial, found) == DATABASE_SUCCESS && found.slot == expected[n], 
+          "insertCard slot", expected[n]);
+  }
+  db.close();
+
+  /* Everything still matches after the index is checked (and rebuilt if needed) at bootup */
+  CardDatabase again;
+  again.setFormat(fmt);
+  again.begin();
+  while (again.isRebuilding()) {
+    check(again.poll() == DATABASE_SUCCESS, "rebuilding the index", 0);
+  }
+  sprintf(info.serial, "200-%05d", 2);
+  check(again.lookupCard(info.serial, info) == DATABASE_SUCCESS && info.slot == NUM_RECORDS, 
+        "lookupCard after bootup", NUM_RECORDS);
+  check_slot(again, NUM_RECORDS-1, "lookupCard after bootup");
+  again.close();
+}
+
+int main()
+{
+  for (int fmt = 0; fmt < DATABASE_NUM_FORMATS; fmt++) {
+    run(fmt);
+  }
+
+  printf(failures ? "%d checks failed\n" : "All checks passed\n", failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,169 @@
+/*
+ * Benchmarks the card format decoders (src/CardFormat.cpp) on a PC. Thousands of random cards 
+ * are encoded in each supported format, then every frame is decoded and checked. A copy of each 
+ * frame with one bit flipped must be rejected by the parity check.
+ *
+ * Build and run from the top of the tree:
+ *
+ *   g++ -O2 -Iutils/host -Isrc utils/formatbench.cpp src/CardFormat.cpp src/CardKey.cpp -o formatbench
+ *   ./formatbench [frames per format]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+
+#include "CardFormat.h"
+
+/* The frames are built here from the published layout of each format, bit by bit, so they don't 
+ * share any code with the decoders. Bits are numbered 1..n from the first bit sent. */
+struct Layout
+{
+  const char *name;
+  int bits;
+  int facilityStart, facilityLen;
+  int cardStart, cardLen;
+};
+
+static const Layout layouts[] = {
+  {"H10301 26-bit",      26,  2,  8, 10, 16},
+  {"H10306 34-bit",      34,  2, 16, 18, 16},
+  {"Corporate 1000 35",  35,  3, 12, 15, 20},
+  {"H10304 37-bit",      37,  2, 16, 18, 19},
+};
+
+#define NUM_LAYOUTS  (sizeof(layouts)/sizeof(layouts[0]))
+
+typedef unsigned long long frame_t;
+
+static int get_bit(frame_t frame, int bits, int n)
+{
+  return (frame >> (bits - n)) & 1;
+}
+
+static void set_bit(frame_t &frame, int bits, int n, int v)
+{
+  frame_t mask = (frame_t)1 << (bits - n);
+  frame = v ? (frame | mask) : (frame & ~mask);
+}
+
+/* Returns the parity of bits first..last, leaving out the bits where n%3 == skip (for the 
+ * Corporate 1000 format) if skip isn't zero */
+static int sum_bits(frame_t frame, int bits, int first, int last, int skip)
+{
+  int sum = 0;
+  for (int n = first; n <= last; n++) {
+    if (skip && n % 3 == skip) continue;
+    sum += get_bit(frame, bits, n);
+  }
+  return sum & 1;
+}
+
+static frame_t encode(const Layout &l, unsigned long facility, unsigned long card)
+{
+  frame_t frame = 0;
+  for (int n = 0; n < l.facilityLen; n++) {
+    set_bit(frame, l.bits, l.facilityStart + n, (facility >> (l.facilityLen-1-n)) & 1);
+  }
+  for (int n = 0; n < l.cardLen; n++) {
+    set_bit(frame, l.bits, l.cardStart + n, (card >> (l.cardLen-1-n)) & 1);
+  }
+  int half = l.bits/2;
+  switch(l.bits) {
+    case 35:
+      /* Bit 2 is even parity over the bits from 3 (skipping 5, 8, ...), bit 35 is odd parity 
+       * over the bits from 2 (skipping 4, 7, ...) and bit 1 is odd parity over everything */
+      set_bit(frame, l.bits, 2, sum_bits(frame, l.bits, 3, 34, 2));
+      set_bit(frame, l.bits, 35, !sum_bits(frame, l.bits, 2, 33, 1));
+      set_bit(frame, l.bits, 1, !sum_bits(frame, l.bits, 2, 35, 0));
+      break;
+    case 37:
+      /* The parity bits overlap on bit 19 */
+      set_bit(frame, l.bits, 1, sum_bits(frame, l.bits, 2, 19, 0));
+      set_bit(frame, l.bits, 37, !sum_bits(frame, l.bits, 19, 36, 0));
+      break;
+    default:
+      /* Even parity over the first half, odd parity over the second half */
+      set_bit(frame, l.bits, 1, sum_bits(frame, l.bits, 2, half, 0));
+      set_bit(frame, l.bits, l.bits, !sum_bits(frame, l.bits, half+1, l.bits-1, 0));
+      break;
+  }
+  /* Add the sentinel bit ahead of the card data */
+  return frame | ((frame_t)1 << l.bits);
+}
+
+static unsigned long random_bits(int n)
+{
+  unsigned long v = ((unsigned long)rand() << 16) ^ (unsigned long)rand();
+  return v & ((1UL << n) - 1);
+}
+
+int main(int argc, char **argv)
+{
+  int count = (argc > 1) ? atoi(argv[1]) : 10000;
+  int failures = 0;
+  srand(1);
+
+  for (unsigned int f = 0; f < NUM_LAYOUTS; f++)
+  {
+    const Layout &l = layouts[f];
+    std::vector<frame_t> frames(count);
+    std::vector<cardkey_t> expected(count);
+    for (int n = 0; n < count; n++) {
+      unsigned long facility = random_bits(l.facilityLen);
+      unsigned long card = random_bits(l.cardLen);
+      frames[n] = encode(l, facility, card);
+      expected[n] = CARD_KEY(l.bits, facility, card);
+    }
+
+    /* Decode every frame a few times over, so the timing is long enough to measure */
+    int rounds = 50, bad = 0, rejected = 0;
+    clock_t start = clock();
+    for (int r = 0; r < rounds; r++) {
+      for (int n = 0; n < count; n++) {
+        unsigned long low = (unsigned long)(frames[n] & 0xFFFFFFFFUL);
+        byte high = (byte)(frames[n] >> 32);
+        cardkey_t key;
+        CardFormat format;
+        if (!find_card_format(low, high, format) || format.bits != l.bits || !format.decode(low, high, key) || 
+            key != expected[n]) {
+          bad++;
+        }
+      }
+    }
+    double secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    /* A single flipped bit must always fail the parity checks */
+    for (int n = 0; n < count; n++) {
+      frame_t frame = frames[n] ^ ((frame_t)1 << (rand() % l.bits));
+      cardkey_t key;
+      CardFormat format;
+      if (!find_card_format((unsigned long)(frame & 0xFFFFFFFFUL), (byte)(frame >> 32), format) ||
+          !format.decode((unsigned long)(frame & 0xFFFFFFFFUL), (byte)(frame >> 32), key)) {
+        rejected++;
+      }
+    }
+
+    printf("%-20s %6d frames  %7.1f ns/frame  %d bad  %d/%d corrupt frames rejected\n", l.name, count, 
+      1e9*secs/((double)rounds*count), bad, rejected, count);
+    if (bad || rejected != count) failures++;
+
+    if (l.bits == 26) 
+    {
+      /* For comparison, the fixed 26-bit extraction the reader used before there were decoders 
+       * (no format lookup or parity checks) */
+      volatile unsigned long sink = 0;
+      start = clock();
+      for (int r = 0; r < rounds; r++) {
+        for (int n = 0; n < count; n++) {
+          unsigned long payload = (unsigned long)(frames[n] & 0xFFFFFFFFUL) >> 1;
+          sink = sink + CARD_KEY(26, (payload >> 16) & 0xFF, payload & 0xFFFF);
+        }
+      }
+      secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+      printf("%-20s %6d frames  %7.1f ns/frame\n", "(fixed 26-bit)", count, 1e9*secs/((double)rounds*count));
+    }
+  }
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,7 @@
+/* See utils/host/Arduino.h */
+
+#include "Arduino.h"
+
+byte hostPins[HOST_NUM_PINS];
+byte hostPinModes[HOST_NUM_PINS];
+unsigned long hostMicros;
@@ -0,0 +1,59 @@
+/* Just enough of Arduino.h to build parts of the sketch on a PC (see utils/formatbench.cpp, 
+ * utils/logdecode.cpp, utils/dbreads.cpp and utils/readersim.cpp) */
+
+#ifndef __HOST_ARDUINO_H__
+#define __HOST_ARDUINO_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "avr/pgmspace.h"
+
+typedef uint8_t boolean;
+typedef uint8_t byte;
+
+/* Simulated GPIO. The pins are plain variables (defined in utils/host/Arduino.cpp) that a 
+ * program sets to drive the sketch's inputs, and reads to see its outputs. The clock only 
+ * moves when the program sets hostMicros. */
+#define HIGH        1
+#define LOW         0
+#define INPUT       0
+#define OUTPUT      1
+
+#define HOST_NUM_PINS   20
+
+extern byte hostPins[HOST_NUM_PINS];
+extern byte hostPinModes[HOST_NUM_PINS];
+extern unsigned long hostMicros;
+
+inline void pinMode(int pin, int mode) { hostPinModes[pin] = mode; }
+inline int digitalRead(int pin) { return hostPins[pin]; }
+inline void digitalWrite(int pin, int value) { hostPins[pin] = value; }
+inline unsigned long micros() { return hostMicros; }
+inline unsigned long millis() { return hostMicros/1000; }
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+/* The output half of the Arduino stream classes, printing to stdout */
+class Print
+{
+  public:
+    virtual size_t write(uint8_t ch) { return fputc(ch, stdout) == EOF ? 0 : 1; }
+    size_t print(const char *str) { return fputs(str, stdout) == EOF ? 0 : strlen(str); }
+    size_t print(char ch) { return write(ch); }
+    size_t print(long n) { return printf("%ld", n); }
+    size_t println() { return print("\r\n"); }
+    size_t println(const char *str) { return print(str) + println(); }
+};
+
+class Stream : public Print
+{
+  public:
+    virtual int available() { return 0; }
+    virtual int read() { return -1; }
+};
+
+#endif
@@ -0,0 +1,154 @@
+/* See utils/host/SD.h */
+
+#include <map>
+#include <string>
+#include <vector>
+#include <strings.h>
+#include "SD.h"
+
+struct SDFileData
+{
+  std::vector<uint8_t> bytes;
+};
+
+/* File names on the card aren't case sensitive */
+struct NameLess
+{
+  bool operator()(const std::string &a, const std::string &b) const 
+  { 
+    return strcasecmp(a.c_str(), b.c_str()) < 0; 
+  }
+};
+
+static std::map<std::string, SDFileData*, NameLess> files;
+
+SDStats sdStats;
+SDClass SD;
+
+/* The block held in the SD library's cache, and whether it needs writing back */
+static SDFileData *cacheFile = NULL;
+static uint32_t cacheBlock = 0;
+static boolean cacheDirty = false;
+
+/* Counts the block transfers needed to read or write 'len' bytes of a file from 'pos' */
+static void cache_blocks(SDFileData *data, uint32_t pos, uint32_t len, boolean write)
+{
+  if (len == 0) return;
+  for (uint32_t block = pos/SD_BLOCK_LEN; block <= (pos+len-1)/SD_BLOCK_LEN; block++)
+  {
+    if (data != cacheFile || block != cacheBlock) {
+      if (cacheDirty) sdStats.blockWrites++;
+      /* Writing a block that's past the end of the file doesn't need it read first */
+      if (!write || block*SD_BLOCK_LEN < data->bytes.size()) sdStats.blockReads++;
+      cacheFile = data;
+      cacheBlock = block;
+      cacheDirty = false;
+    }
+    cacheDirty = cacheDirty || write;
+  }
+}
+
+int File::read()
+{
+  byte ch;
+  return (read(&ch, 1) == 1) ? ch : -1;
+}
+
+int File::read(void *buf, uint16_t len)
+{
+  if (!data) return -1;
+  sdStats.reads++;
+  uint32_t n = 0;
+  if (pos < data->bytes.size()) {
+    n = data->bytes.size() - pos;
+  }
+  if (n > len) n = len;
+  if (n > 0) {
+    cache_blocks(data, pos, n, false);
+    memcpy(buf, &data->bytes[pos], n);
+  }
+  pos += n;
+  sdStats.readBytes += n;
+  return n;
+}
+
+size_t File::write(const uint8_t *buf, size_t len)
+{
+  if (!data) return 0;
+  sdStats.writes++;
+  cache_blocks(data, pos, len, true);
+  if (pos + len > data->bytes.size()) {
+    data->bytes.resize(pos + len);
+  }
+  if (len > 0) {
+    memcpy(&data->bytes[pos], buf, len);
+  }
+  pos += len;
+  sdStats.writeBytes += len;
+  return len;
+}
+
+boolean File::seek(uint32_t p)
+{
+  if (!data || p > data->bytes.size()) return false;
+  sdStats.seeks++;
+  pos = p;
+  return true;
+}
+
+uint32_t File::position()
+{
+  return pos;
+}
+
+uint32_t File::size()
+{
+  return data ? data->bytes.size() : 0;
+}
+
+void File::flush()
+{
+  if (cacheDirty) {
+    sdStats.blockWrites++;
+    cacheDirty = false;
+  }
+}
+
+void File::close()
+{
+  if (data) flush();
+  data = NULL;
+}
+
+File SDClass::open(const char *name, uint8_t mode)
+{
+  sdStats.opens++;
+  SDFileData *data = files[name];
+  if (!data) {
+    if (mode == FILE_READ) {
+      files.erase(name);
+      return File();
+    }
+    data = files[name] = new SDFileData;
+  }
+  /* Like the SD library, writing starts at the end of the file */
+  return File(data, (mode == FILE_READ) ? 0 : data->bytes.size());
+}
+
+boolean SDClass::exists(const char *name)
+{
+  return files.count(name) > 0;
+}
+
+boolean SDClass::remove(const char *name)
+{
+  /* Handles still open on the file keep the old contents (and we don't free it) */
+  std::map<std::string, SDFileData*, NameLess>::iterator it = files.find(name);
+  if (it == files.end()) return false;
+  if (it->second == cacheFile) {
+    cacheFile = NULL;
+    cacheDirty = false;
+  }
+  files.erase(it);
+  return true;
+}
@@ -0,0 +1,70 @@
+/* A stand-in for the Arduino SD library that keeps the "SD card" in memory on a PC, and counts 
+ * how the sketch uses it. This is how the database code's reads are measured (see 
+ * utils/dbreads.cpp). Like the SD library, every handle open on a file sees the same contents. */
+
+#ifndef __HOST_SD_H__
+#define __HOST_SD_H__
+
+#include "Arduino.h"
+
+#define FILE_READ    1
+#define FILE_WRITE   2
+
+/* The size of a block on the card. Like the SD library, one block is cached at a time. */
+#define SD_BLOCK_LEN 512
+
+/* Running totals of the calls made on every file, and of the blocks the SD library would have 
+ * transferred to and from the card to serve them (which is what takes the time) */
+struct SDStats
+{
+  unsigned long opens;
+  unsigned long reads;
+  unsigned long readBytes;
+  unsigned long writes;
+  unsigned long writeBytes;
+  unsigned long seeks;
+  unsigned long blockReads;
+  unsigned long blockWrites;
+};
+
+extern SDStats sdStats;
+
+/* The contents of a file on the card */
+struct SDFileData;
+
+class File : public Stream
+{
+  private:
+    SDFileData *data;
+    uint32_t pos;
+
+  public:
+    File() { data = NULL; pos = 0; }
+    File(SDFileData *d, uint32_t p) { data = d; pos = p; }
+
+    operator bool() const { return data != NULL; }
+
+    int read();
+    int read(void *buf, uint16_t len);
+    size_t write(uint8_t ch) { return write(&ch, 1); }
+    size_t write(const uint8_t *buf, size_t len);
+    boolean seek(uint32_t pos);
+    uint32_t position();
+    uint32_t size();
+    int available() { return size() - position(); }
+    void flush();
+    void close();
+};
+
+class SDClass
+{
+  public:
+    boolean begin(uint8_t) { return true; }
+    File open(const char *name, uint8_t mode = FILE_READ);
+    boolean exists(const char *name);
+    boolean remove(const char *name);
+};
+
+extern SDClass SD;
+
+#endif
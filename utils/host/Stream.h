@@ -0,0 +1,2 @@
+/* See utils/host/Arduino.h */
+#include "Arduino.h"
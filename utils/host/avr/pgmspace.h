@@ -0,0 +1,17 @@
+/* Program memory is just ordinary memory on a PC (see utils/host/Arduino.h) */
+
+#ifndef __HOST_PGMSPACE_H__
+#define __HOST_PGMSPACE_H__
+
+#include <string.h>
+
+#define PROGMEM
+typedef char prog_char;
+#define pgm_read_byte(addr)  (*(const unsigned char*)(addr))
+#define pgm_read_word(addr)  (*(addr))
+#define memcpy_P             memcpy
+#define strlen_P             strlen
+#define strcmp_P             strcmp
+#define strncmp_P            strncmp
+
+#endif
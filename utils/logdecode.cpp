@@ -0,0 +1,109 @@
+/*
+ * Converts binary log files (written with "log-format = binary" in hausprox.cfg) back into the
+ * text log format, so they can be read and searched like the text logs. See src/LogRecord.h for
+ * the layout of the records.
+ *
+ * Build and run from the top of the tree:
+ *
+ *   g++ -O2 -Iutils/host -Isrc utils/logdecode.cpp src/LogRecord.cpp src/DateTime.cpp src/CardKey.cpp -o logdecode
+ *   ./logdecode hp-12-02.bin [...] > hp-12-02.log
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "LogRecord.h"
+#include "DateTime.h"
+#include "Const.h"
+
+/* The number of records read from the file at once */
+#define READ_RECORDS   4096
+
+/* Decodes the records in 'buf', which holds 'count' records. Returns the number of records used,
+ * which is less than 'count' if the last message's card frame runs past the end of the buffer. */
+static size_t decode_records(const byte *buf, size_t count, FILE *out)
+{
+  size_t pos = 0;
+  while (pos < count)
+  {
+    LogRecord rec;
+    unpack_log_record(buf + pos*LOG_RECORD_LEN, rec);
+    size_t frameRecords = LOG_FRAME_RECORDS(rec.frameBits);
+    if (pos + 1 + frameRecords > count) {
+      break;
+    }
+
+    /* Same format as Logger::printEvent, with the line endings the sketch writes */
+    DateTime time;
+    char str[32];
+    epoch_to_date(rec.time, time);
+    format_date_time(time, str, sizeof(str));
+    fputs(str, out);
+    fputs(log_type_str(rec.level), out);
+    const prog_char *msg = log_message_str(rec.msg);
+    fputs(msg ? msg : strUnknown, out);
+    if (rec.flags & LOG_RECORD_KEY) {
+      format_serial(rec.key, str);
+      fputs(strSerialPart, out);
+      fputs(str, out);
+    }
+    if (rec.frameBits > 0)
+    {
+      const byte *frame = buf + (pos+1)*LOG_RECORD_LEN;
+      for (int n = 0; n < rec.frameBits; n++) {
+        fputc('0' + ((frame[n >> 3] >> (n & 7)) & 1), out);
+      }
+      fputs("\r\n", out);
+    }
+    fputc('\n', out);
+    pos += 1 + frameRecords;
+  }
+  return pos;
+}
+
+static int decode_file(const char *path, FILE *out)
+{
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    fprintf(stderr, "%s: can't open file\n", path);
+    return 1;
+  }
+  byte header[LOG_RECORD_LEN];
+  if (fread(header, 1, LOG_RECORD_LEN, file) != LOG_RECORD_LEN || !check_log_header(header)) {
+    fprintf(stderr, "%s: not a binary log file\n", path);
+    fclose(file);
+    return 1;
+  }
+
+  /* Read the records in large blocks, carrying over any message split across the blocks */
+  byte *buf = (byte*)malloc(READ_RECORDS*LOG_RECORD_LEN);
+  size_t count = 0;
+  while (1)
+  {
+    size_t n = fread(buf + count*LOG_RECORD_LEN, LOG_RECORD_LEN, READ_RECORDS-count, file);
+    count += n;
+    size_t used = decode_records(buf, count, out);
+    memmove(buf, buf + used*LOG_RECORD_LEN, (count-used)*LOG_RECORD_LEN);
+    count -= used;
+    if (n == 0) break;
+  }
+  if (count > 0) {
+    fprintf(stderr, "%s: log ends part way through a message\n", path);
+  }
+  free(buf);
+  fclose(file);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s file.bin [...]\n", argv[0]);
+    return 1;
+  }
+  int ret = 0;
+  for (int n = 1; n < argc; n++) {
+    ret |= decode_file(argv[n], stdout);
+  }
+  return ret;
+}
@@ -0,0 +1,287 @@
+/*
+ * Replays logic analyser captures of the card reader (like doc/card-swipe-35752.csv) through
+ * src/CardReader.cpp on a PC. The captured data, clock and present levels are written to the
+ * simulated pins in utils/host, so the reader goes through its FastPin accessors (src/Pins.h)
+ * just as it does on the board, and receiveCardData is called on each falling clock edge the
+ * way the interrupt is. Each capture prints the card read and the bits received.
+ *
+ * With -burst, the captures are instead replayed as bursts of back to back swipes (every third
+ * one with a bit flipped, so it fails to decode). The frame queue is only emptied every few
+ * swipes, as if the main loop were busy looking up cards, and each frame taken off the queue
+ * is checked against the swipe it came from: the card or error, the bits and the time.
+ *
+ * Build and run from the top of the tree:
+ *
+ *   g++ -O2 -Iutils/host -Isrc utils/readersim.cpp utils/host/Arduino.cpp src/CardReader.cpp src/CardFormat.cpp src/CardKey.cpp -o readersim
+ *   ./readersim doc/card-swipe-35752.csv doc/card-swipe-35770.csv
+ *   ./readersim -burst doc/card-swipe-35752.csv doc/card-swipe-35770.csv
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <deque>
+
+#include "CardReader.h"
+#include "Pins.h"
+
+/* The number of swipes in each burst */
+#define BURST_SWIPES      12
+
+/* The quiet time between swipes in a burst (us), enough for the reader to end the frame */
+#define BURST_GAP         50000UL
+
+/* The clock edge that has its data bit flipped in a corrupted swipe */
+#define CORRUPT_EDGE      40
+
+/* The most frames that can wait in the queue */
+#define QUEUE_FRAMES      FRAME_QUEUE_LEN
+
+/* The pin levels at a point in a capture (time in us from the start of the swipe) */
+struct Sample
+{
+  unsigned long time;
+  byte data;
+  byte clock;
+  byte present;
+};
+
+struct Capture
+{
+  const char *path;
+  std::vector<Sample> samples;
+  unsigned long length;
+};
+
+/* What the reader made of a swipe */
+struct FrameResult
+{
+  int error;
+  char serial[READER_SERIAL_BUF_LEN];
+  std::string bits;
+  unsigned long time;
+};
+
+static Stream out;
+
+/* Reads a capture, starting from when the card present line goes low. Returns false if the
+ * file can't be read. */
+static boolean load_capture(const char *path, Capture &cap)
+{
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    printf("%s: can't open\n", path);
+    return false;
+  }
+  cap.path = path;
+  cap.samples.clear();
+
+  /* Each line after the heading is "time (s), data, clock, present" */
+  char line[128];
+  fgets(line, sizeof(line), f);
+  double first = -1;
+  while (fgets(line, sizeof(line), f))
+  {
+    double t;
+    int data, clock, present;
+    if (sscanf(line, "%lf, %d, %d, %d", &t, &data, &clock, &present) != 4) {
+      continue;
+    }
+    if (first < 0) {
+      if (present != LOW) continue;
+      first = t;
+    }
+    Sample s;
+    s.time = (unsigned long)((t - first)*1000000);
+    s.data = data;
+    s.clock = clock;
+    s.present = present;
+    cap.samples.push_back(s);
+  }
+  fclose(f);
+  if (cap.samples.empty()) {
+    printf("%s: no swipe found\n", path);
+    return false;
+  }
+  cap.length = cap.samples.back().time;
+  return true;
+}
+
+/* Plays a capture through the pins starting at 'start' (us). The data bit on clock edge
+ * 'corrupt' is flipped, unless it is -1. */
+static void play(CardReader &reader, const Capture &cap, unsigned long start, int corrupt)
+{
+  int lastClock = HIGH;
+  int edge = 0;
+  for (size_t n = 0; n < cap.samples.size(); n++)
+  {
+    const Sample &s = cap.samples[n];
+    hostMicros = start + s.time;
+    hostPins[PIN_DATA] = s.data;
+    hostPins[PIN_PRESENT] = s.present;
+    hostPins[PIN_CLOCK] = s.clock;
+    if (lastClock == HIGH && s.clock == LOW) {
+      if (edge == corrupt) hostPins[PIN_DATA] = !s.data;
+      reader.receiveCardData();
+      hostPins[PIN_DATA] = s.data;
+      edge++;
+    }
+    lastClock = s.clock;
+  }
+}
+
+/* Takes the oldest frame off the reader's queue */
+static void take_frame(CardReader &reader, FrameResult &frame)
+{
+  frame.serial[0] = 0;
+  frame.error = reader.readCard(frame.serial, sizeof(frame.serial));
+  frame.bits.clear();
+  for (int n = 0; n < reader.getFrameBits(); n++) {
+    frame.bits += (reader.getFrameData(n) == 1) ? '1' : '0';
+  }
+  frame.time = reader.getFrameTime();
+  reader.clearCardData();
+}
+
+/* Replays a capture on its own. Returns false if no card was decoded. */
+static boolean replay(const Capture &cap)
+{
+  CardReader reader;
+  reader.begin();
+  if (hostPinModes[PIN_CLOCK] != INPUT || hostPinModes[PIN_DATA] != INPUT ||
+      hostPinModes[PIN_PRESENT] != INPUT || hostPinModes[PIN_BEEP] != OUTPUT ||
+      hostPins[PIN_BEEP] != HIGH) {
+    printf("%s: reader pins not set up\n", cap.path);
+    return false;
+  }
+  play(reader, cap, 0, -1);
+  if (!reader.hasCardData()) {
+    printf("%s: no frame\n", cap.path);
+    return false;
+  }
+  FrameResult frame;
+  take_frame(reader, frame);
+  if (frame.error != CARD_SUCCESS) {
+    printf("%s: error %d\n", cap.path, frame.error);
+    return false;
+  }
+  printf("%s: %s (%d bits)\n", cap.path, frame.serial, (int)frame.bits.size());
+  out.println(frame.bits.c_str());
+  return true;
+}
+
+/* Plays a burst of swipes, emptying the queue after every 'every' swipes. Returns the number of
+ * frames that didn't match their swipe, or were lost when they shouldn't have been. */
+static int burst(const std::vector<Capture> &caps, const std::vector<FrameResult> *expect, int every)
+{
+  CardReader reader;
+  reader.begin();
+  hostMicros = 0;
+
+  /* The swipes that should be waiting in the queue, oldest first */
+  std::deque<int> waiting;
+  unsigned long start[BURST_SWIPES];
+  int handled = 0, dropped = 0, wrong = 0;
+
+  unsigned long t = 1000000;
+  for (int n = 0; n < BURST_SWIPES; n++)
+  {
+    const Capture &cap = caps[n % caps.size()];
+    boolean corrupt = (n % 3 == 2);
+    start[n] = t;
+    play(reader, cap, t, corrupt ? CORRUPT_EDGE : -1);
+    t += cap.length + BURST_GAP;
+    if (waiting.size() < QUEUE_FRAMES) {
+      waiting.push_back(n);
+    } else {
+      dropped++;
+    }
+
+    if ((n+1) % every != 0 && n+1 < BURST_SWIPES) {
+      continue;
+    }
+    /* The main loop gets around to the queue */
+    hostMicros = t - BURST_GAP/2;
+    while (reader.hasCardData())
+    {
+      FrameResult frame;
+      take_frame(reader, frame);
+      if (waiting.empty()) {
+        printf("  unexpected frame %s\n", frame.serial);
+        wrong++;
+        continue;
+      }
+      int s = waiting.front();
+      waiting.pop_front();
+      const FrameResult &e = expect[s % 3 == 2][s % caps.size()];
+      if (frame.error != e.error || strcmp(frame.serial, e.serial) != 0 || frame.bits != e.bits ||
+          frame.time != start[s] + e.time) {
+        printf("  swipe %d: got error %d, %s, %d bits at %lu us\n", s, frame.error, frame.serial,
+               (int)frame.bits.size(), frame.time - start[s]);
+        wrong++;
+      }
+      handled++;
+    }
+  }
+  wrong += waiting.size();
+  if (reader.framesDropped != (unsigned int)dropped) {
+    printf("  reader dropped %u frames, expected %d\n", reader.framesDropped, dropped);
+    wrong++;
+  }
+  printf("Queue emptied every %d swipes: %d handled, %d dropped, most queued %d, %d wrong\n",
+         every, handled, dropped, (int)reader.framesQueuedMax, wrong);
+  return wrong;
+}
+
+int main(int argc, char **argv)
+{
+  boolean bursts = (argc > 1 && strcmp(argv[1], "-burst") == 0);
+  std::vector<Capture> caps;
+  for (int n = bursts ? 2 : 1; n < argc; n++) {
+    Capture cap;
+    if (!load_capture(argv[n], cap)) return 1;
+    caps.push_back(cap);
+  }
+
+  if (!bursts) {
+    int failed = 0;
+    for (size_t n = 0; n < caps.size(); n++) {
+      if (!replay(caps[n])) failed++;
+    }
+    return failed ? 1 : 0;
+  }
+  if (caps.empty()) {
+    return 1;
+  }
+
+  /* Each swipe on its own, clean and corrupted, is what the frames in a burst should match */
+  std::vector<FrameResult> expect[2];
+  for (int corrupt = 0; corrupt < 2; corrupt++) {
+    for (size_t n = 0; n < caps.size(); n++) {
+      CardReader reader;
+      reader.begin();
+      play(reader, caps[n], 0, corrupt ? CORRUPT_EDGE : -1);
+      FrameResult frame;
+      if (!reader.hasCardData()) {
+        printf("%s: no frame\n", caps[n].path);
+        return 1;
+      }
+      take_frame(reader, frame);
+      printf("%s%s: error %d, %s, %d bits\n", caps[n].path, corrupt ? " (corrupted)" : "",
+             frame.error, frame.serial, (int)frame.bits.size());
+      expect[corrupt].push_back(frame);
+    }
+  }
+
+  int wrong = 0;
+  for (int every = 1; every <= QUEUE_FRAMES+1; every++) {
+    wrong += burst(caps, expect, every);
+  }
+  if (wrong) {
+    printf("%d frames wrong\n", wrong);
+    return 1;
+  }
+  printf("All frames matched\n");
+  return 0;
+}